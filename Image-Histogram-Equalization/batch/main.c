@@ -0,0 +1,702 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <time.h>
+#include <glob.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <jpeglib.h>
+#include <omp.h>
+#include "../libhisteq/histeq.h"
+#include "pipeline.h"
+
+// Non-interactive batch equalizer: equalizes every input JPEG into an output
+// directory. Decoding, equalization and encoding of different images overlap
+// in a three-stage pipeline (pipeline.c).
+
+typedef struct {
+    char **paths;
+    size_t *roots;      // length of the root each path was found under, '/' included
+    size_t count;
+    size_t capacity;
+} FileList;
+
+typedef struct {
+    const FileList *files;
+    const char *outputDir;
+    const char *nameTemplate;
+    const HistEqBackend *backend;
+    int stripHeight;
+    int scaleDenom;
+    const HistEqCLAHEParams *clahe;     // NULL for global equalization
+    int teamSize;                       // OpenMP threads per worker
+    atomic_ullong bytesIn;
+    atomic_ullong pixels;
+} BatchJob;
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [options] <input>...\n"
+            "Inputs are JPEG files, directories, glob patterns, or '-' to read one path per line from stdin.\n"
+            "  -o DIR        output directory (default: .)\n"
+            "  -n TEMPLATE   output name, {dir} {name} {ext} {index} are replaced (default: {dir}{name}_equalized{ext});\n"
+            "                {dir} is the input's directory below the directory it was found in, e.g. 'a/b/'\n"
+            "  -j N          worker threads (default: number of cores)\n"
+            "  -p D:E:C      decode, equalize and encode threads, overrides -j\n"
+            "  -q N          images queued between two stages (default: 2 per worker)\n"
+            "  -s            no stealing: workers only run their own stage\n"
+            "  -t ROWS       stream each image in strips of ROWS scanlines instead of decoding it whole\n"
+            "  -a DENOM      streaming histogram from a 1/DENOM scale decode (2, 4 or 8), implies -t\n"
+            "  -y            equalize only the Y plane of the stored YCbCr data, keeping colour\n"
+            "  -c            like -y, but transcode at the DCT level: chroma coefficients are copied verbatim\n"
+            "  -l TXxTY[:CLIP] CLAHE with a TX by TY tile grid and clip limit (default: 8x8:2), also with -y\n"
+            "  -b BACKEND    scalar, openmp or simd (default: simd)\n"
+            "  -r            recurse into subdirectories\n"
+            "  -f            fixed-point luma for colour images (HISTEQ_LUMA_FAST)\n"
+            "  -T PREFIX     write the stage trace to PREFIX.json (Chrome) and PREFIX.prom (Prometheus);\n"
+            "                the library must be built with -DHISTEQ_TRACE\n",
+            program);
+}
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// `root` is the length of the directory prefix the output keeps out of {dir}:
+// the input directory for files found in one, the whole dirname otherwise
+static void addFile(FileList *list, const char *path, size_t root) {
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? list->capacity * 2 : 256;
+        list->paths = (char **)realloc(list->paths, list->capacity * sizeof(char *));
+        list->roots = (size_t *)realloc(list->roots, list->capacity * sizeof(size_t));
+        if (list->paths == NULL || list->roots == NULL) {
+            perror("Memory allocation failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    list->roots[list->count] = root;
+    list->paths[list->count] = strdup(path);
+    if (list->paths[list->count] == NULL) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    list->count++;
+}
+
+static int isJPEGName(const char *name) {
+    const char *extension = strrchr(name, '.');
+    return extension != NULL && (strcasecmp(extension, ".jpg") == 0 || strcasecmp(extension, ".jpeg") == 0);
+}
+
+static void addDirectory(FileList *list, const char *dirPath, size_t root, int recursive) {
+    DIR *dir = opendir(dirPath);
+    if (dir == NULL) {
+        fprintf(stderr, "Error opening directory '%s': %s\n", dirPath, strerror(errno));
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", dirPath, entry->d_name);
+
+        struct stat st;
+        if (stat(path, &st) != 0) {
+            continue;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            if (recursive) {
+                addDirectory(list, path, root, recursive);
+            }
+        } else if (isJPEGName(entry->d_name)) {
+            addFile(list, path, root);
+        }
+    }
+    closedir(dir);
+}
+
+static void addInput(FileList *list, const char *input, int recursive) {
+    struct stat st;
+    if (stat(input, &st) == 0) {
+        if (S_ISDIR(st.st_mode)) {
+            size_t length = strlen(input);
+            addDirectory(list, input, (length > 0 && input[length - 1] == '/') ? length : length + 1, recursive);
+        } else {
+            const char *base = strrchr(input, '/');
+            addFile(list, input, base ? (size_t)(base + 1 - input) : 0);
+        }
+        return;
+    }
+
+    // Not an existing path: treat it as a glob pattern (quoted on the command line)
+    glob_t matches;
+    if (glob(input, 0, NULL, &matches) == 0) {
+        for (size_t i = 0; i < matches.gl_pathc; i++) {
+            addInput(list, matches.gl_pathv[i], recursive);
+        }
+        globfree(&matches);
+    } else {
+        fprintf(stderr, "No such file or pattern match: '%s'\n", input);
+    }
+}
+
+static void addManifest(FileList *list, FILE *manifest, int recursive) {
+    char line[4096];
+    while (fgets(line, sizeof(line), manifest) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0') {
+            addInput(list, line, recursive);
+        }
+    }
+}
+
+static int makeDirectories(const char *path) {
+    char buffer[4096];
+    snprintf(buffer, sizeof(buffer), "%s", path);
+    for (char *p = buffer + 1; *p != '\0'; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            if (mkdir(buffer, 0777) != 0 && errno != EEXIST) {
+                return -1;
+            }
+            *p = '/';
+        }
+    }
+    if (mkdir(buffer, 0777) != 0 && errno != EEXIST) {
+        return -1;
+    }
+    return 0;
+}
+
+// Expand {dir}, {name}, {ext} and {index} in the output name template
+static void outputPath(char *out, size_t size, const char *outputDir, const char *nameTemplate, const FileList *files, size_t index) {
+    const char *inputPath = files->paths[index];
+    const char *relative = inputPath + files->roots[index];
+    const char *base = strrchr(relative, '/');
+    base = base ? base + 1 : relative;
+    const char *extension = strrchr(base, '.');
+    size_t nameLength = extension ? (size_t)(extension - base) : strlen(base);
+    if (extension == NULL) {
+        extension = "";
+    }
+
+    size_t used = (size_t)snprintf(out, size, "%s/", outputDir);
+    for (const char *t = nameTemplate; *t != '\0' && used + 1 < size; ) {
+        if (strncmp(t, "{dir}", 5) == 0) {
+            used += snprintf(out + used, size - used, "%.*s", (int)(base - relative), relative);
+            t += 5;
+        } else if (strncmp(t, "{name}", 6) == 0) {
+            used += snprintf(out + used, size - used, "%.*s", (int)nameLength, base);
+            t += 6;
+        } else if (strncmp(t, "{ext}", 5) == 0) {
+            used += snprintf(out + used, size - used, "%s", extension);
+            t += 5;
+        } else if (strncmp(t, "{index}", 7) == 0) {
+            used += snprintf(out + used, size - used, "%zu", index);
+            t += 7;
+        } else {
+            out[used++] = *t++;
+            out[used] = '\0';
+        }
+    }
+}
+
+typedef struct {
+    unsigned long long key;
+    size_t index;
+} OutputKey;
+
+static int compareKeys(const void *a, const void *b) {
+    const OutputKey *x = (const OutputKey *)a, *y = (const OutputKey *)b;
+    if (x->key != y->key) {
+        return (x->key > y->key) - (x->key < y->key);
+    }
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+// FNV-1a; equal hashes are confirmed on the paths themselves
+static unsigned long long hashPath(const char *path) {
+    unsigned long long hash = 14695981039346656037ull;
+    for (const char *c = path; *c != '\0'; c++) {
+        hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// First entry of a sorted key array that is not below `key`
+static size_t lowerBound(const OutputKey *keys, size_t count, unsigned long long key) {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (keys[mid].key < key) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static unsigned long long fileKey(const struct stat *st) {
+    return ((unsigned long long)st->st_dev << 40) ^ (unsigned long long)st->st_ino;
+}
+
+// Before anything is written: every input must get an output path of its own,
+// and no output may be an input, which the streaming mode would truncate while
+// still reading it. Also creates the subdirectories {dir} asks for. Keeps only
+// 64-bit keys per file, so it stays small for millions of inputs.
+static int prepareOutputs(const FileList *files, const char *outputDir, const char *nameTemplate) {
+    OutputKey *outputs = (OutputKey *)malloc(files->count * sizeof(OutputKey));
+    OutputKey *inputs = (OutputKey *)malloc(files->count * sizeof(OutputKey));
+    if (outputs == NULL || inputs == NULL) {
+        perror("Memory allocation failed");
+        free(outputs);
+        free(inputs);
+        return -1;
+    }
+
+    size_t inputCount = 0;
+    for (size_t i = 0; i < files->count; i++) {
+        struct stat st;
+        if (stat(files->paths[i], &st) == 0) {
+            inputs[inputCount].key = fileKey(&st);
+            inputs[inputCount++].index = i;
+        }
+    }
+    qsort(inputs, inputCount, sizeof(OutputKey), compareKeys);
+
+    int status = 0;
+    char path[4096], other[4096], madeDir[4096] = "";
+    for (size_t i = 0; i < files->count && status == 0; i++) {
+        outputPath(path, sizeof(path), outputDir, nameTemplate, files, i);
+        outputs[i].key = hashPath(path);
+        outputs[i].index = i;
+
+        // Outputs of one directory come one after another, so this rarely mkdirs
+        char *slash = strrchr(path, '/');
+        if (slash != NULL) {
+            *slash = '\0';
+            if (strcmp(path, madeDir) != 0) {
+                if (makeDirectories(path) != 0) {
+                    fprintf(stderr, "Error creating output directory '%s': %s\n", path, strerror(errno));
+                    status = -1;
+                }
+                snprintf(madeDir, sizeof(madeDir), "%s", path);
+            }
+            *slash = '/';
+        }
+
+        struct stat st;
+        if (status == 0 && stat(path, &st) == 0) {
+            unsigned long long key = fileKey(&st);
+            size_t match = lowerBound(inputs, inputCount, key);
+            if (match < inputCount && inputs[match].key == key) {
+                fprintf(stderr, "Output '%s' would overwrite input '%s'\n", path, files->paths[inputs[match].index]);
+                status = -1;
+            }
+        }
+    }
+
+    // Within each run of equal hashes, compare every pair of paths
+    qsort(outputs, files->count, sizeof(OutputKey), compareKeys);
+    for (size_t run = 0; run < files->count && status == 0; ) {
+        size_t end = run + 1;
+        while (end < files->count && outputs[end].key == outputs[run].key) {
+            end++;
+        }
+        for (size_t a = run; a + 1 < end && status == 0; a++) {
+            outputPath(path, sizeof(path), outputDir, nameTemplate, files, outputs[a].index);
+            for (size_t b = a + 1; b < end && status == 0; b++) {
+                outputPath(other, sizeof(other), outputDir, nameTemplate, files, outputs[b].index);
+                if (strcmp(path, other) == 0) {
+                    fprintf(stderr, "Inputs '%s' and '%s' would both be written to '%s'; use {dir} or {index} in -n\n",
+                            files->paths[outputs[a].index], files->paths[outputs[b].index], path);
+                    status = -1;
+                }
+            }
+        }
+        run = end;
+    }
+
+    free(outputs);
+    free(inputs);
+    return status;
+}
+
+static void countInputBytes(BatchJob *job, const char *inputPath) {
+    struct stat st;
+    if (stat(inputPath, &st) == 0) {
+        atomic_fetch_add(&job->bytesIn, (unsigned long long)st.st_size);
+    }
+}
+
+static int decodeStage(void *context, PipelineTask *task) {
+    BatchJob *job = (BatchJob *)context;
+    const char *inputPath = job->files->paths[task->index];
+
+    countInputBytes(job, inputPath);
+    if (histeqReadJPEG(inputPath, &task->data, &task->width, &task->height, &task->color_space) != 0) {
+        return -1;
+    }
+    if (task->color_space != JCS_GRAYSCALE && task->color_space != JCS_RGB) {
+        fprintf(stderr, "Unsupported colour space in '%s'\n", inputPath);
+        return -1;
+    }
+    return 0;
+}
+
+// The workers already keep the cores busy, so OpenMP regions inside a stage
+// (CLAHE, the openmp backend) get a share of the cores instead of a full team
+// each; the team size is a per-thread setting, so every worker sets its own
+static void workerStart(void *context) {
+    omp_set_num_threads(((BatchJob *)context)->teamSize);
+}
+
+static int equalizeStage(void *context, PipelineTask *task) {
+    BatchJob *job = (BatchJob *)context;
+    int components = (task->color_space == JCS_GRAYSCALE) ? 1 : 3;
+    if (job->clahe != NULL) {
+        if (histeqCLAHE(task->data, task->width, task->height, components, job->clahe) != 0) {
+            return -1;
+        }
+    } else {
+        histeqEqualize(job->backend, task->data, task->width, task->height, components, NULL, NULL);
+    }
+    atomic_fetch_add(&job->pixels, (unsigned long long)task->width * task->height);
+    return 0;
+}
+
+static int encodeStage(void *context, PipelineTask *task) {
+    BatchJob *job = (BatchJob *)context;
+    char path[4096];
+    outputPath(path, sizeof(path), job->outputDir, job->nameTemplate, job->files, task->index);
+    return histeqWriteJPEG(path, task->data, task->width, task->height, task->color_space);
+}
+
+// Streaming mode (-t): the same three stages map onto the two decode passes.
+// The task buffer carries a StreamState instead of pixels.
+typedef struct {
+    long long samples;          // pixels behind the histogram, fewer with -a
+    int histogram[HISTEQ_BINS];
+    unsigned char lut[HISTEQ_BINS];
+} StreamState;
+
+static int streamHistogramStage(void *context, PipelineTask *task) {
+    BatchJob *job = (BatchJob *)context;
+    const char *inputPath = job->files->paths[task->index];
+
+    countInputBytes(job, inputPath);
+    StreamState *state = (StreamState *)malloc(sizeof(StreamState));
+    if (state == NULL) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+    task->data = (unsigned char *)state;
+    return histeqStreamHistogramScaled(job->backend, inputPath, job->stripHeight, job->scaleDenom, state->histogram,
+                                       &state->samples, &task->width, &task->height, &task->color_space);
+}
+
+static int streamLUTStage(void *context, PipelineTask *task) {
+    BatchJob *job = (BatchJob *)context;
+    StreamState *state = (StreamState *)task->data;
+    histeqBuildLUT(state->histogram, state->samples, state->lut);
+    atomic_fetch_add(&job->pixels, (unsigned long long)task->width * task->height);
+    return 0;
+}
+
+static int streamEncodeStage(void *context, PipelineTask *task) {
+    BatchJob *job = (BatchJob *)context;
+    StreamState *state = (StreamState *)task->data;
+    char path[4096];
+    outputPath(path, sizeof(path), job->outputDir, job->nameTemplate, job->files, task->index);
+    return histeqStreamApplyLUT(job->backend, job->files->paths[task->index], path, job->stripHeight, state->lut, NULL);
+}
+
+// YCbCr mode (-y): the task buffer is a HistEqPlanarImage
+static int planarDecodeStage(void *context, PipelineTask *task) {
+    BatchJob *job = (BatchJob *)context;
+    const char *inputPath = job->files->paths[task->index];
+
+    countInputBytes(job, inputPath);
+    HistEqPlanarImage *image = (HistEqPlanarImage *)malloc(sizeof(HistEqPlanarImage));
+    if (image == NULL) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+    if (histeqReadJPEGPlanar(inputPath, image) != 0) {
+        free(image);
+        return -1;
+    }
+    task->data = (unsigned char *)image;
+    task->width = image->width;
+    task->height = image->height;
+    return 0;
+}
+
+static int planarEqualizeStage(void *context, PipelineTask *task) {
+    BatchJob *job = (BatchJob *)context;
+    if (job->clahe != NULL) {
+        if (histeqCLAHEPlanar((HistEqPlanarImage *)task->data, job->clahe) != 0) {
+            return -1;
+        }
+    } else if (histeqEqualizePlanar(job->backend, (HistEqPlanarImage *)task->data, NULL, NULL) != 0) {
+        return -1;
+    }
+    atomic_fetch_add(&job->pixels, (unsigned long long)task->width * task->height);
+    return 0;
+}
+
+static int planarEncodeStage(void *context, PipelineTask *task) {
+    BatchJob *job = (BatchJob *)context;
+    char path[4096];
+    outputPath(path, sizeof(path), job->outputDir, job->nameTemplate, job->files, task->index);
+    return histeqWriteJPEGPlanar(path, (const HistEqPlanarImage *)task->data);
+}
+
+static void planarRelease(void *context, PipelineTask *task) {
+    (void)context;
+    histeqFreePlanar((HistEqPlanarImage *)task->data);
+    free(task->data);
+}
+
+// Transcoding mode (-c): the task buffer is a HistEqTranscoder
+static int transcodeOpenStage(void *context, PipelineTask *task) {
+    BatchJob *job = (BatchJob *)context;
+    const char *inputPath = job->files->paths[task->index];
+
+    countInputBytes(job, inputPath);
+    HistEqTranscoder *transcoder = histeqTranscodeOpen(inputPath);
+    if (transcoder == NULL) {
+        return -1;
+    }
+    task->data = (unsigned char *)transcoder;
+    return 0;
+}
+
+static int transcodeEqualizeStage(void *context, PipelineTask *task) {
+    BatchJob *job = (BatchJob *)context;
+    int before[HISTEQ_BINS];
+    if (histeqTranscodeEqualize(job->backend, (HistEqTranscoder *)task->data, before, NULL) != 0) {
+        return -1;
+    }
+
+    unsigned long long pixels = 0;
+    for (int i = 0; i < HISTEQ_BINS; i++) {
+        pixels += before[i];
+    }
+    atomic_fetch_add(&job->pixels, pixels);
+    return 0;
+}
+
+static int transcodeWriteStage(void *context, PipelineTask *task) {
+    BatchJob *job = (BatchJob *)context;
+    char path[4096];
+    outputPath(path, sizeof(path), job->outputDir, job->nameTemplate, job->files, task->index);
+    return histeqTranscodeWrite((HistEqTranscoder *)task->data, path);
+}
+
+static void transcodeRelease(void *context, PipelineTask *task) {
+    (void)context;
+    histeqTranscodeClose((HistEqTranscoder *)task->data);
+}
+
+int main(int argc, char *argv[]) {
+    const char *outputDir = ".";
+    const char *nameTemplate = "{dir}{name}_equalized{ext}";
+    const char *backendName = "simd";
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int stageThreads[STAGE_COUNT] = {0, 0, 0};
+    int queueCapacity = 0;
+    int stealing = 1;
+    int stripHeight = 0;
+    int scaleDenom = 1;
+    int planar = 0;
+    int transcode = 0;
+    int adaptive = 0;
+    HistEqCLAHEParams clahe = {HISTEQ_CLAHE_TILES, HISTEQ_CLAHE_TILES, HISTEQ_CLAHE_CLIP_LIMIT};
+    int recursive = 0;
+    const char *tracePrefix = NULL;
+    int option;
+
+    while ((option = getopt(argc, argv, "o:n:j:p:q:t:a:l:b:T:rsycfh")) != -1) {
+        switch (option) {
+            case 'o': outputDir = optarg; break;
+            case 'n': nameTemplate = optarg; break;
+            case 'j': workers = atol(optarg); break;
+            case 'p':
+                if (sscanf(optarg, "%d:%d:%d", &stageThreads[STAGE_DECODE], &stageThreads[STAGE_EQUALIZE], &stageThreads[STAGE_ENCODE]) != 3) {
+                    fprintf(stderr, "Expected -p decode:equalize:encode, e.g. -p 3:1:2\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'q': queueCapacity = atoi(optarg); break;
+            case 's': stealing = 0; break;
+            case 't':
+                stripHeight = atoi(optarg);
+                if (stripHeight < 1) {
+                    fprintf(stderr, "Strip height must be at least one scanline\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'a':
+                scaleDenom = atoi(optarg);
+                if (scaleDenom != 2 && scaleDenom != 4 && scaleDenom != 8) {
+                    fprintf(stderr, "Scale denominator must be 2, 4 or 8\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'l':
+                adaptive = 1;
+                if (sscanf(optarg, "%dx%d:%lf", &clahe.tilesX, &clahe.tilesY, &clahe.clipLimit) < 2 ||
+                    clahe.tilesX < 1 || clahe.tilesY < 1 || clahe.tilesX > HISTEQ_CLAHE_MAX_TILES || clahe.tilesY > HISTEQ_CLAHE_MAX_TILES) {
+                    fprintf(stderr, "Expected -l TXxTY[:CLIP] with 1 to %d tiles per axis, e.g. -l 8x8:2\n", HISTEQ_CLAHE_MAX_TILES);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'b': backendName = optarg; break;
+            case 'r': recursive = 1; break;
+            case 'y': planar = 1; break;
+            case 'c': transcode = 1; break;
+            case 'f': histeqSetLumaMode(HISTEQ_LUMA_FAST); break;
+            case 'T': tracePrefix = optarg; break;
+            default:
+                usage(argv[0]);
+                return (option == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+    }
+    if (planar + transcode + (stripHeight > 0 || scaleDenom > 1) > 1) {
+        fprintf(stderr, "Only one of -y, -c and -t/-a can be used\n");
+        return EXIT_FAILURE;
+    }
+    if (adaptive && (transcode || stripHeight > 0 || scaleDenom > 1)) {
+        fprintf(stderr, "-l works on whole images and cannot be combined with -c, -t or -a\n");
+        return EXIT_FAILURE;
+    }
+    if (scaleDenom > 1 && stripHeight == 0) {
+        stripHeight = HISTEQ_STRIP_HEIGHT;
+    }
+    if (optind >= argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (workers < 1) {
+        workers = 1;
+    }
+
+    const HistEqBackend *backend = histeqFindBackend(backendName);
+    if (backend == NULL) {
+        fprintf(stderr, "Unknown backend '%s'\n", backendName);
+        return EXIT_FAILURE;
+    }
+
+    FileList files = {NULL, NULL, 0, 0};
+    for (int i = optind; i < argc; i++) {
+        if (strcmp(argv[i], "-") == 0) {
+            addManifest(&files, stdin, recursive);
+        } else {
+            addInput(&files, argv[i], recursive);
+        }
+    }
+    if (files.count == 0) {
+        fprintf(stderr, "No input images\n");
+        return EXIT_FAILURE;
+    }
+    if (makeDirectories(outputDir) != 0) {
+        fprintf(stderr, "Error creating output directory '%s': %s\n", outputDir, strerror(errno));
+        return EXIT_FAILURE;
+    }
+    if (prepareOutputs(&files, outputDir, nameTemplate) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    if (stageThreads[STAGE_DECODE] + stageThreads[STAGE_EQUALIZE] + stageThreads[STAGE_ENCODE] == 0) {
+        // Decode and encode cost the most, so they get the first homes
+        static const PipelineStage homes[STAGE_COUNT] = {STAGE_DECODE, STAGE_ENCODE, STAGE_EQUALIZE};
+        for (long i = 0; i < workers; i++) {
+            stageThreads[homes[i % STAGE_COUNT]]++;
+        }
+    }
+    if (!stealing && (stageThreads[STAGE_DECODE] < 1 || stageThreads[STAGE_EQUALIZE] < 1 || stageThreads[STAGE_ENCODE] < 1)) {
+        fprintf(stderr, "Without stealing every stage needs at least one thread\n");
+        return EXIT_FAILURE;
+    }
+    workers = stageThreads[STAGE_DECODE] + stageThreads[STAGE_EQUALIZE] + stageThreads[STAGE_ENCODE];
+
+    BatchJob job;
+    job.files = &files;
+    job.outputDir = outputDir;
+    job.nameTemplate = nameTemplate;
+    job.backend = backend;
+    job.stripHeight = stripHeight;
+    job.scaleDenom = scaleDenom;
+    job.clahe = adaptive ? &clahe : NULL;
+    job.teamSize = (omp_get_max_threads() > workers) ? (int)(omp_get_max_threads() / workers) : 1;
+    atomic_init(&job.bytesIn, 0);
+    atomic_init(&job.pixels, 0);
+
+    PipelineConfig config;
+    config.decode = stripHeight ? streamHistogramStage : decodeStage;
+    config.equalize = stripHeight ? streamLUTStage : equalizeStage;
+    config.encode = stripHeight ? streamEncodeStage : encodeStage;
+    config.release = NULL;
+    config.start = workerStart;
+    if (planar) {
+        config.decode = planarDecodeStage;
+        config.equalize = planarEqualizeStage;
+        config.encode = planarEncodeStage;
+        config.release = planarRelease;
+    } else if (transcode) {
+        config.decode = transcodeOpenStage;
+        config.equalize = transcodeEqualizeStage;
+        config.encode = transcodeWriteStage;
+        config.release = transcodeRelease;
+    }
+    config.context = &job;
+    config.taskCount = files.count;
+    memcpy(config.threads, stageThreads, sizeof(stageThreads));
+    config.queueCapacity = (queueCapacity > 0) ? queueCapacity : (int)(2 * workers);
+    config.stealing = stealing;
+
+    PipelineStats stats;
+    double start = nowSeconds();
+    if (runPipeline(&config, &stats) != 0) {
+        return EXIT_FAILURE;
+    }
+    double elapsed = nowSeconds() - start;
+
+    double megabytes = atomic_load(&job.bytesIn) / 1e6;
+    double megapixels = atomic_load(&job.pixels) / 1e6;
+    printf("Equalized %zu of %zu images (%zu failed) with %ld workers (%d:%d:%d) in %.2f seconds\n",
+           stats.completed, files.count, stats.failed, workers,
+           stageThreads[STAGE_DECODE], stageThreads[STAGE_EQUALIZE], stageThreads[STAGE_ENCODE], elapsed);
+    printf("%.1f images/s, %.1f MB/s compressed input, %.1f MP/s\n",
+           stats.completed / elapsed, megabytes / elapsed, megapixels / elapsed);
+    printf("Stage busy time: decode %.2f s, equalize %.2f s, encode %.2f s; %zu stage runs stolen\n",
+           stats.busySeconds[STAGE_DECODE], stats.busySeconds[STAGE_EQUALIZE], stats.busySeconds[STAGE_ENCODE], stats.stolen);
+
+    if (tracePrefix != NULL) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s.json", tracePrefix);
+        histeqTraceWriteChrome(path);
+        snprintf(path, sizeof(path), "%s.prom", tracePrefix);
+        histeqTraceWritePrometheus(path);
+    }
+
+    for (size_t i = 0; i < files.count; i++) {
+        free(files.paths[i]);
+    }
+    free(files.paths);
+    free(files.roots);
+    return stats.failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "pipeline.h"
+
+// Ring buffer of tasks waiting for the next stage
+typedef struct {
+    PipelineTask **items;
+    int capacity;
+    int head;
+    int count;
+} TaskQueue;
+
+typedef struct {
+    const PipelineConfig *config;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    TaskQueue queues[2];            // decode -> equalize, equalize -> encode
+    size_t nextTask;
+    int stealing;
+    int running[STAGE_COUNT];       // tasks currently inside each stage
+    PipelineStats stats;
+} Pipeline;
+
+typedef struct {
+    Pipeline *pipeline;
+    PipelineStage home;
+} Worker;
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void pushTask(TaskQueue *queue, PipelineTask *task) {
+    queue->items[(queue->head + queue->count) % queue->capacity] = task;
+    queue->count++;
+}
+
+static PipelineTask *popTask(TaskQueue *queue) {
+    PipelineTask *task = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+    return task;
+}
+
+// Whether a stage can start a task now. A stage may only start when its
+// output queue has room for the result, which keeps every queue bounded.
+static int stageReady(const Pipeline *p, PipelineStage stage) {
+    int capacity = p->config->queueCapacity;
+    switch (stage) {
+        case STAGE_DECODE:
+            return p->nextTask < p->config->taskCount && p->queues[0].count + p->running[STAGE_DECODE] < capacity;
+        case STAGE_EQUALIZE:
+            return p->queues[0].count > 0 && p->queues[1].count + p->running[STAGE_EQUALIZE] < capacity;
+        case STAGE_ENCODE:
+            return p->queues[1].count > 0;
+        default:
+            return 0;
+    }
+}
+
+// Home stage first, then the others from the encode end backwards, so work in
+// flight drains before new images are decoded
+static int pickStage(const Pipeline *p, PipelineStage home) {
+    static const PipelineStage order[STAGE_COUNT] = {STAGE_ENCODE, STAGE_EQUALIZE, STAGE_DECODE};
+
+    if (stageReady(p, home)) {
+        return home;
+    }
+    if (!p->stealing) {
+        return -1;
+    }
+    for (int i = 0; i < STAGE_COUNT; i++) {
+        if (stageReady(p, order[i])) {
+            return order[i];
+        }
+    }
+    return -1;
+}
+
+static int pipelineDone(const Pipeline *p) {
+    return p->nextTask == p->config->taskCount && p->queues[0].count == 0 && p->queues[1].count == 0 &&
+           p->running[STAGE_DECODE] == 0 && p->running[STAGE_EQUALIZE] == 0 && p->running[STAGE_ENCODE] == 0;
+}
+
+static int runStage(const PipelineConfig *config, PipelineStage stage, PipelineTask *task) {
+    switch (stage) {
+        case STAGE_DECODE: return config->decode(config->context, task);
+        case STAGE_EQUALIZE: return config->equalize(config->context, task);
+        default: return config->encode(config->context, task);
+    }
+}
+
+static void *pipelineWorker(void *arg) {
+    Worker *worker = (Worker *)arg;
+    Pipeline *p = worker->pipeline;
+    if (p->config->start != NULL) {
+        p->config->start(p->config->context);
+    }
+
+    pthread_mutex_lock(&p->lock);
+    for (;;) {
+        int stage = pickStage(p, worker->home);
+        if (stage < 0) {
+            if (pipelineDone(p)) {
+                break;
+            }
+            pthread_cond_wait(&p->changed, &p->lock);
+            continue;
+        }
+
+        PipelineTask *task;
+        if (stage == STAGE_DECODE) {
+            task = (PipelineTask *)calloc(1, sizeof(PipelineTask));
+            if (task == NULL) {
+                perror("Memory allocation failed");
+                p->nextTask++;
+                p->stats.failed++;
+                continue;
+            }
+            task->index = p->nextTask++;
+        } else {
+            task = popTask(&p->queues[stage - 1]);
+        }
+        p->running[stage]++;
+        if (stage != (int)worker->home) {
+            p->stats.stolen++;
+        }
+        pthread_mutex_unlock(&p->lock);
+
+        double start = nowSeconds();
+        int status = runStage(p->config, (PipelineStage)stage, task);
+        double elapsed = nowSeconds() - start;
+
+        pthread_mutex_lock(&p->lock);
+        p->running[stage]--;
+        p->stats.busySeconds[stage] += elapsed;
+        if (status != 0 || stage == STAGE_ENCODE) {
+            if (status != 0) {
+                p->stats.failed++;
+            } else {
+                p->stats.completed++;
+            }
+            if (p->config->release != NULL && task->data != NULL) {
+                p->config->release(p->config->context, task);
+            } else {
+                free(task->data);
+            }
+            free(task);
+        } else {
+            pushTask(&p->queues[stage], task);
+        }
+        pthread_cond_broadcast(&p->changed);
+    }
+    pthread_mutex_unlock(&p->lock);
+    return NULL;
+}
+
+int runPipeline(const PipelineConfig *config, PipelineStats *stats) {
+    Pipeline p;
+    memset(&p, 0, sizeof(p));
+    p.config = config;
+    p.stealing = config->stealing;
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.changed, NULL);
+
+    int workerCount = config->threads[STAGE_DECODE] + config->threads[STAGE_EQUALIZE] + config->threads[STAGE_ENCODE];
+    Worker *workers = (Worker *)malloc(workerCount * sizeof(Worker));
+    pthread_t *threads = (pthread_t *)malloc(workerCount * sizeof(pthread_t));
+    p.queues[0].items = (PipelineTask **)malloc(config->queueCapacity * sizeof(PipelineTask *));
+    p.queues[1].items = (PipelineTask **)malloc(config->queueCapacity * sizeof(PipelineTask *));
+    p.queues[0].capacity = p.queues[1].capacity = config->queueCapacity;
+
+    int status = 0;
+    int started = 0;
+    if (workers == NULL || threads == NULL || p.queues[0].items == NULL || p.queues[1].items == NULL) {
+        perror("Memory allocation failed");
+        status = -1;
+    } else {
+        for (int stage = 0; stage < STAGE_COUNT && status == 0; stage++) {
+            for (int i = 0; i < config->threads[stage]; i++) {
+                workers[started].pipeline = &p;
+                workers[started].home = (PipelineStage)stage;
+                if (pthread_create(&threads[started], NULL, pipelineWorker, &workers[started]) != 0) {
+                    fprintf(stderr, "Error starting pipeline worker\n");
+                    status = -1;
+                    break;
+                }
+                started++;
+            }
+        }
+        // Workers that did start finish the remaining tasks between them; they
+        // need stealing for that since some stage may have no thread
+        if (status != 0) {
+            pthread_mutex_lock(&p.lock);
+            p.stealing = 1;
+            pthread_cond_broadcast(&p.changed);
+            pthread_mutex_unlock(&p.lock);
+        }
+    }
+
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    *stats = p.stats;
+    free(p.queues[0].items);
+    free(p.queues[1].items);
+    free(workers);
+    free(threads);
+    pthread_mutex_destroy(&p.lock);
+    pthread_cond_destroy(&p.changed);
+    return (status == 0 || started > 0) ? 0 : -1;
+}
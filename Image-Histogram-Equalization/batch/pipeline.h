@@ -0,0 +1,51 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stddef.h>
+
+// Three-stage decode -> equalize -> encode pipeline over a fixed number of
+// tasks. Stages are joined by bounded queues, so at most a few decoded images
+// are held in memory at once. Every worker thread has a home stage, but when
+// that stage has nothing to do it takes work from another stage (downstream
+// first), so cores stay busy when image sizes vary.
+
+typedef enum {
+    STAGE_DECODE = 0,
+    STAGE_EQUALIZE,
+    STAGE_ENCODE,
+    STAGE_COUNT
+} PipelineStage;
+
+typedef struct {
+    size_t index;               // which input, 0 .. taskCount - 1
+    unsigned char *data;        // decoded image, released by the pipeline
+    int width;
+    int height;
+    int color_space;
+} PipelineTask;
+
+typedef struct {
+    // Stage callbacks return 0 on success; a failed task is dropped
+    int (*decode)(void *context, PipelineTask *task);
+    int (*equalize)(void *context, PipelineTask *task);
+    int (*encode)(void *context, PipelineTask *task);
+    void (*release)(void *context, PipelineTask *task);    // frees task->data; NULL means free()
+    void (*start)(void *context);   // run once on each worker before its first task; may be NULL
+    void *context;
+    size_t taskCount;
+    int threads[STAGE_COUNT];   // worker threads per home stage
+    int queueCapacity;          // images waiting between two stages
+    int stealing;               // let idle workers run other stages
+} PipelineConfig;
+
+typedef struct {
+    size_t completed;
+    size_t failed;
+    size_t stolen;              // stage runs outside the worker's home stage
+    double busySeconds[STAGE_COUNT];
+} PipelineStats;
+
+// Runs all tasks and returns 0, or -1 if the workers could not be started
+int runPipeline(const PipelineConfig *config, PipelineStats *stats);
+
+#endif
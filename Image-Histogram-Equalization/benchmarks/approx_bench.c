@@ -0,0 +1,65 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../libhisteq/histeq.h"
+
+// Time and accuracy of the histogram pass when the image is decoded at
+// 1/1, 1/2, 1/4 and 1/8 scale. Errors are measured against the full-size
+// histogram: the largest CDF distance (fraction of pixels) and the largest and
+// mean LUT difference in gray levels.
+// Usage: approx_bench <image.jpg> [repetitions]
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <image.jpg> [repetitions]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int repetitions = (argc > 2) ? atoi(argv[2]) : 3;
+    const HistEqBackend *backend = histeqGetBackend(HISTEQ_BACKEND_SIMD);
+
+    int exact[HISTEQ_BINS];
+    long long exactSamples = 0;
+    double exactTime = 0;
+
+    printf("%-6s %10s %8s %12s %10s %8s %9s\n", "scale", "ms", "speedup", "samples", "CDF err", "LUT max", "LUT mean");
+    for (int denom = 1; denom <= 8; denom *= 2) {
+        int histogram[HISTEQ_BINS];
+        long long samples;
+        int width, height, color_space;
+        double best = 1e30;
+
+        // Keep the fastest repetition
+        for (int r = 0; r < repetitions; r++) {
+            double start = nowSeconds();
+            if (histeqStreamHistogramScaled(backend, argv[1], 0, denom, histogram, &samples, &width, &height, &color_space) != 0) {
+                return EXIT_FAILURE;
+            }
+            double elapsed = nowSeconds() - start;
+            if (elapsed < best) {
+                best = elapsed;
+            }
+        }
+
+        if (denom == 1) {
+            for (int i = 0; i < HISTEQ_BINS; i++) {
+                exact[i] = histogram[i];
+            }
+            exactSamples = samples;
+            exactTime = best;
+            printf("%dx%d\n", width, height);
+        }
+
+        double cdfError, lutMeanError;
+        int lutMaxError;
+        histeqCompareHistograms(exact, exactSamples, histogram, samples, &cdfError, &lutMaxError, &lutMeanError);
+        printf("1/%-4d %10.1f %8.1f %12lld %10.4f %8d %9.2f\n", denom, best * 1e3, exactTime / best, samples,
+               cdfError, lutMaxError, lutMeanError);
+    }
+    return EXIT_SUCCESS;
+}
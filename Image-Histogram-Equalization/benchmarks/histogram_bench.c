@@ -0,0 +1,200 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "../libhisteq/histeq.h"
+
+// Histogram throughput of each backend on uniform noise, a smooth
+// natural-like image and a constant image, in grayscale and RGB; then the
+// single-thread histogram and apply kernels for 8-bit, 12-bit and 16-bit gray.
+// Before timing the wide kernels it checks histeqHistogram16() against plain
+// counting at every depth from 1 to 16 bits, which covers both the banked
+// uint32 path (up to 4096 bins) and the flushed uint16 banks, and exits with
+// an error on any mismatch.
+// Usage: histogram_bench [megapixels] [repetitions]
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void fillImage(unsigned char *data, int width, int height, int components, const char *pattern) {
+    unsigned int seed = 12345;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < components; c++) {
+                size_t index = ((size_t)y * width + x) * components + c;
+                seed = seed * 1103515245u + 12345u;
+                if (strcmp(pattern, "uniform") == 0) {
+                    data[index] = (unsigned char)(seed >> 24);
+                } else if (strcmp(pattern, "natural") == 0) {
+                    // Slow gradients with a little sensor noise: long runs of nearby values
+                    double value = 128 + 60 * sin(x / 97.0 + c) * cos(y / 53.0) + (int)(seed >> 30) - 2;
+                    data[index] = (unsigned char)value;
+                } else {
+                    data[index] = 200;
+                }
+            }
+        }
+    }
+}
+
+// The same patterns at a given depth, 16-bit samples
+static void fillImage16(unsigned short *data, size_t pixels, int width, int bits, const char *pattern) {
+    unsigned int seed = 12345;
+    int top = (1 << bits) - 1;
+    for (size_t i = 0; i < pixels; i++) {
+        seed = seed * 1103515245u + 12345u;
+        if (strcmp(pattern, "uniform") == 0) {
+            data[i] = (unsigned short)((seed >> 16) & top);
+        } else if (strcmp(pattern, "natural") == 0) {
+            double value = (top + 1) * (0.5 + 0.23 * sin(i % width / 97.0) * cos(i / width / 53.0)) + (int)(seed >> 29) - 4;
+            // The noise can leave the range at very low depths
+            data[i] = (unsigned short)((value < 0) ? 0 : (value > top) ? top : value);
+        } else {
+            data[i] = (unsigned short)(top * 3 / 4);
+        }
+    }
+}
+
+// Best of `repetitions` for one kernel, in megapixels per second
+static void timeDepth(unsigned short *data, unsigned char *bytes, size_t pixels, int bits, int repetitions,
+                      double *histogramRate, double *applyRate) {
+    static unsigned int histogram[1 << HISTEQ_WIDE_MAX_BITS];
+    static unsigned short lut[(1 << HISTEQ_WIDE_MAX_BITS) + 1];
+    int histogram8[HISTEQ_BINS];
+    unsigned char lut8[HISTEQ_BINS];
+    double bestHistogram = 1e30, bestApply = 1e30;
+
+    for (int r = 0; r <= repetitions; r++) {
+        double start = nowSeconds();
+        if (bits == 8) {
+            memset(histogram8, 0, sizeof(histogram8));
+            histeqHistogramRow(bytes, pixels, histogram8);
+        } else {
+            memset(histogram, 0, ((size_t)1 << bits) * sizeof(unsigned int));
+            histeqHistogram16(data, pixels, bits, histogram);
+        }
+        double middle = nowSeconds();
+        if (bits == 8) {
+            histeqBuildLUT(histogram8, (long long)pixels, lut8);
+            middle = nowSeconds();
+            histeqApplyLUTRow(bytes, pixels, lut8);
+        } else {
+            histeqBuildLUT16(histogram, bits, (long long)pixels, bits, lut);
+            middle = nowSeconds();
+            histeqApplyLUT16Row(data, pixels, lut);
+        }
+        double end = nowSeconds();
+        // Repetition 0 is the warm-up
+        if (r > 0 && middle - start < bestHistogram) {
+            bestHistogram = middle - start;
+        }
+        if (r > 0 && end - middle < bestApply) {
+            bestApply = end - middle;
+        }
+    }
+    *histogramRate = pixels / bestHistogram / 1e6;
+    *applyRate = pixels / bestApply / 1e6;
+}
+
+// 0 when histeqHistogram16() agrees with plain counting on `pixels` samples
+static int checkHistogram16(unsigned short *data, size_t pixels, int width, const char *pattern) {
+    static unsigned int histogram[1 << HISTEQ_WIDE_MAX_BITS];
+    static unsigned int expected[1 << HISTEQ_WIDE_MAX_BITS];
+    for (int bits = 1; bits <= HISTEQ_WIDE_MAX_BITS; bits++) {
+        size_t bins = (size_t)1 << bits;
+        fillImage16(data, pixels, width, bits, pattern);
+        memset(histogram, 0, bins * sizeof(unsigned int));
+        memset(expected, 0, bins * sizeof(unsigned int));
+        histeqHistogram16(data, pixels, bits, histogram);
+        for (size_t i = 0; i < pixels; i++) {
+            expected[data[i]]++;
+        }
+        for (size_t v = 0; v < bins; v++) {
+            if (histogram[v] != expected[v]) {
+                fprintf(stderr, "histeqHistogram16 mismatch: %s, %d bits, bin %zu: %u instead of %u\n",
+                        pattern, bits, v, histogram[v], expected[v]);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int megapixels = (argc > 1) ? atoi(argv[1]) : 16;
+    int repetitions = (argc > 2) ? atoi(argv[2]) : 5;
+    const char *patterns[] = {"uniform", "natural", "constant"};
+
+    int width = 4096;
+    int height = megapixels * 1024 * 1024 / width;
+    unsigned char *data = (unsigned char *)malloc((size_t)width * height * 3);
+    if (data == NULL) {
+        perror("Memory allocation failed");
+        return EXIT_FAILURE;
+    }
+
+    printf("%-9s %-10s %-8s %10s\n", "pattern", "components", "backend", "MB/s");
+    for (int p = 0; p < 3; p++) {
+        for (int components = 1; components <= 3; components += 2) {
+            fillImage(data, width, height, components, patterns[p]);
+            size_t bytes = (size_t)width * height * components;
+
+            for (int id = 0; id < HISTEQ_BACKEND_COUNT; id++) {
+                const HistEqBackend *backend = histeqGetBackend(id);
+                int histogram[HISTEQ_BINS];
+                double best = 1e30;
+
+                // One warm-up run, then keep the fastest repetition
+                histeqComputeHistogram(backend, data, width, height, components, histogram);
+                for (int r = 0; r < repetitions; r++) {
+                    double start = nowSeconds();
+                    histeqComputeHistogram(backend, data, width, height, components, histogram);
+                    double elapsed = nowSeconds() - start;
+                    if (elapsed < best) {
+                        best = elapsed;
+                    }
+                }
+                printf("%-9s %-10d %-8s %10.1f\n", patterns[p], components, backend->name, bytes / best / 1e6);
+            }
+        }
+    }
+
+    // Gray kernels by sample depth; 12-bit data gets a 4096-bin histogram
+    size_t pixels = (size_t)width * height;
+    unsigned short *wide = (unsigned short *)malloc(pixels * sizeof(unsigned short));
+    if (wide == NULL) {
+        perror("Memory allocation failed");
+        free(data);
+        return EXIT_FAILURE;
+    }
+    // An odd count, so the unpaired last sample is counted too
+    for (int p = 0; p < 3; p++) {
+        if (checkHistogram16(wide, (pixels < 1000001) ? pixels - (pixels % 2 == 0) : 1000001, width, patterns[p]) != 0) {
+            free(wide);
+            free(data);
+            return EXIT_FAILURE;
+        }
+    }
+    printf("\n%-9s %-5s %12s %12s\n", "pattern", "bits", "hist Mpx/s", "apply Mpx/s");
+    for (int p = 0; p < 3; p++) {
+        const int depths[] = {8, 12, 16};
+        for (int d = 0; d < 3; d++) {
+            double histogramRate, applyRate;
+            if (depths[d] == 8) {
+                fillImage(data, width, height, 1, patterns[p]);
+            } else {
+                fillImage16(wide, pixels, width, depths[d], patterns[p]);
+            }
+            timeDepth(wide, data, pixels, depths[d], repetitions, &histogramRate, &applyRate);
+            printf("%-9s %-5d %12.1f %12.1f\n", patterns[p], depths[d], histogramRate, applyRate);
+        }
+    }
+
+    free(wide);
+    free(data);
+    return EXIT_SUCCESS;
+}
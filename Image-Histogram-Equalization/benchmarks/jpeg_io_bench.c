@@ -0,0 +1,163 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <jpeglib.h>
+#include "../libhisteq/histeq.h"
+
+// Cost of calling libjpeg with different numbers of scanlines per
+// jpeg_read_scanlines/jpeg_write_scanlines call. The compressed file is held
+// in memory so disk speed does not enter the measurement.
+// Usage: jpeg_io_bench <image.jpg> [repetitions]
+
+#define MAX_ROWS 64
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Decodes the whole image `rowsPerCall` scanlines at a time; returns the call count
+static long decodeImage(const unsigned char *jpeg, unsigned long jpegSize, unsigned char *pixels, int rowsPerCall) {
+    struct jpeg_decompress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    JSAMPROW row_pointers[MAX_ROWS];
+    long calls = 0;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, jpeg, jpegSize);
+    jpeg_read_header(&cinfo, TRUE);
+    jpeg_start_decompress(&cinfo);
+
+    size_t row_stride = (size_t)cinfo.output_width * cinfo.output_components;
+    while (cinfo.output_scanline < cinfo.output_height) {
+        int rows = cinfo.output_height - cinfo.output_scanline;
+        if (rows > rowsPerCall) {
+            rows = rowsPerCall;
+        }
+        for (int i = 0; i < rows; i++) {
+            row_pointers[i] = pixels + (cinfo.output_scanline + i) * row_stride;
+        }
+        jpeg_read_scanlines(&cinfo, row_pointers, rows);
+        calls++;
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return calls;
+}
+
+static long encodeImage(unsigned char *pixels, int width, int height, int color_space, int rowsPerCall) {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    JSAMPROW row_pointers[MAX_ROWS];
+    unsigned char *jpeg = NULL;
+    unsigned long jpegSize = 0;
+    long calls = 0;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_mem_dest(&cinfo, &jpeg, &jpegSize);
+
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = (color_space == JCS_GRAYSCALE) ? 1 : 3;
+    cinfo.in_color_space = color_space;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 75, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    size_t row_stride = (size_t)width * cinfo.input_components;
+    while (cinfo.next_scanline < cinfo.image_height) {
+        int rows = cinfo.image_height - cinfo.next_scanline;
+        if (rows > rowsPerCall) {
+            rows = rowsPerCall;
+        }
+        for (int i = 0; i < rows; i++) {
+            row_pointers[i] = pixels + (cinfo.next_scanline + i) * row_stride;
+        }
+        jpeg_write_scanlines(&cinfo, row_pointers, rows);
+        calls++;
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    free(jpeg);
+    return calls;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <image.jpg> [repetitions]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int repetitions = (argc > 2) ? atoi(argv[2]) : 5;
+
+    FILE *file = fopen(argv[1], "rb");
+    if (file == NULL) {
+        perror("Error opening file");
+        return EXIT_FAILURE;
+    }
+    fseek(file, 0, SEEK_END);
+    unsigned long jpegSize = (unsigned long)ftell(file);
+    rewind(file);
+    unsigned char *jpeg = (unsigned char *)malloc(jpegSize);
+    if (jpeg == NULL || fread(jpeg, 1, jpegSize, file) != jpegSize) {
+        fprintf(stderr, "Error reading '%s'\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    fclose(file);
+
+    unsigned char *pixels = NULL;
+    int width, height, color_space;
+    if (histeqReadJPEG(argv[1], &pixels, &width, &height, &color_space) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    const int rowCounts[] = {1, 2, 4, 8, 16, 32, 64};
+    const int tests = sizeof(rowCounts) / sizeof(rowCounts[0]);
+    double decodeTime[7], encodeTime[7];
+    long decodeCalls[7], encodeCalls[7];
+
+    printf("%dx%d, %d component(s)\n", width, height, (color_space == JCS_GRAYSCALE) ? 1 : 3);
+    printf("%-5s %12s %8s %12s %8s\n", "rows", "decode ms", "calls", "encode ms", "calls");
+    for (int t = 0; t < tests; t++) {
+        decodeTime[t] = encodeTime[t] = 1e30;
+
+        // Keep the fastest repetition of each
+        for (int r = 0; r < repetitions; r++) {
+            double start = nowSeconds();
+            decodeCalls[t] = decodeImage(jpeg, jpegSize, pixels, rowCounts[t]);
+            double elapsed = nowSeconds() - start;
+            if (elapsed < decodeTime[t]) {
+                decodeTime[t] = elapsed;
+            }
+
+            start = nowSeconds();
+            encodeCalls[t] = encodeImage(pixels, width, height, color_space, rowCounts[t]);
+            elapsed = nowSeconds() - start;
+            if (elapsed < encodeTime[t]) {
+                encodeTime[t] = elapsed;
+            }
+        }
+        printf("%-5d %12.2f %8ld %12.2f %8ld\n", rowCounts[t], decodeTime[t] * 1e3, decodeCalls[t],
+               encodeTime[t] * 1e3, encodeCalls[t]);
+    }
+
+    // Time saved per call avoided, going from one row per call to the widest
+    // batch. The decoder may return fewer rows than asked for, in which case
+    // no calls are avoided and there is nothing to report.
+    int last = tests - 1;
+    if (decodeCalls[0] > decodeCalls[last]) {
+        printf("Per-call overhead, decode: %.0f ns\n",
+               (decodeTime[0] - decodeTime[last]) / (decodeCalls[0] - decodeCalls[last]) * 1e9);
+    }
+    printf("Per-call overhead, encode: %.0f ns\n",
+           (encodeTime[0] - encodeTime[last]) / (encodeCalls[0] - encodeCalls[last]) * 1e9);
+
+    free(pixels);
+    free(jpeg);
+    return EXIT_SUCCESS;
+}
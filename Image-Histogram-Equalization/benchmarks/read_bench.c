@@ -0,0 +1,116 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/resource.h>
+#include "../libhisteq/histeq.h"
+
+// Decode cost of many files through histeqReadJPEG() with stdio input versus
+// mmap input. A warm-up pass puts the files in the page cache, so the
+// difference is the syscall and copy overhead of the input path. User and
+// system CPU time come from getrusage.
+// Usage: read_bench <directory | image.jpg>... [-r repetitions]
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static double cpuSeconds(const struct timeval *tv) {
+    return tv->tv_sec + tv->tv_usec * 1e-6;
+}
+
+static char **paths;
+static size_t pathCount;
+
+static void addPath(const char *path) {
+    paths = (char **)realloc(paths, (pathCount + 1) * sizeof(char *));
+    if (paths == NULL || (paths[pathCount] = strdup(path)) == NULL) {
+        perror("Memory allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    pathCount++;
+}
+
+static void addInput(const char *input) {
+    DIR *dir = opendir(input);
+    if (dir == NULL) {
+        addPath(input);
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        const char *extension = strrchr(entry->d_name, '.');
+        if (extension != NULL && (strcmp(extension, ".jpg") == 0 || strcmp(extension, ".jpeg") == 0)) {
+            char path[4096];
+            snprintf(path, sizeof(path), "%s/%s", input, entry->d_name);
+            addPath(path);
+        }
+    }
+    closedir(dir);
+}
+
+// Decodes every file once; returns the number that decoded
+static size_t decodeAll(void) {
+    size_t decoded = 0;
+    for (size_t i = 0; i < pathCount; i++) {
+        unsigned char *data;
+        int width, height, color_space;
+        if (histeqReadJPEG(paths[i], &data, &width, &height, &color_space) == 0) {
+            free(data);
+            decoded++;
+        }
+    }
+    return decoded;
+}
+
+int main(int argc, char *argv[]) {
+    int repetitions = 3;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            repetitions = atoi(argv[++i]);
+        } else {
+            addInput(argv[i]);
+        }
+    }
+    if (pathCount == 0) {
+        fprintf(stderr, "Usage: %s <directory | image.jpg>... [-r repetitions]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    histeqSetMappedInput(0);
+    size_t decoded = decodeAll();
+    printf("%zu files, %zu decoded\n", pathCount, decoded);
+    printf("%-6s %10s %10s %10s %12s\n", "input", "wall s", "user s", "sys s", "files/s");
+
+    const char *modes[] = {"stdio", "mmap"};
+    for (int mode = 0; mode < 2; mode++) {
+        histeqSetMappedInput(mode);
+        double bestWall = 1e30, bestUser = 0, bestSystem = 0;
+
+        // Keep the repetition with the lowest wall time
+        for (int r = 0; r < repetitions; r++) {
+            struct rusage before, after;
+            getrusage(RUSAGE_SELF, &before);
+            double start = nowSeconds();
+            decodeAll();
+            double wall = nowSeconds() - start;
+            getrusage(RUSAGE_SELF, &after);
+
+            if (wall < bestWall) {
+                bestWall = wall;
+                bestUser = cpuSeconds(&after.ru_utime) - cpuSeconds(&before.ru_utime);
+                bestSystem = cpuSeconds(&after.ru_stime) - cpuSeconds(&before.ru_stime);
+            }
+        }
+        printf("%-6s %10.3f %10.3f %10.3f %12.1f\n", modes[mode], bestWall, bestUser, bestSystem, pathCount / bestWall);
+    }
+
+    for (size_t i = 0; i < pathCount; i++) {
+        free(paths[i]);
+    }
+    free(paths);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,653 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <omp.h>
+#include <jpeglib.h>
+#include "../libhisteq/histeq.h"
+
+// Per-stage timing of the whole pipeline on synthetic images. Every image is
+// encoded to an in-memory JPEG once; each run then decodes it, builds the
+// histogram, the CDF/LUT, applies it and encodes the result, timing every
+// stage on its own with the monotonic clock. After the warm-up runs the
+// median, 99th percentile and minimum per stage are written as CSV or JSON,
+// for each pattern, size, component count, backend and thread count. Thread
+// counts only apply to the OpenMP backend and CLAHE; the others run once, at 1.
+// CLAHE (histeqCLAHE() with the default tiles and clip limit) builds its tile
+// histograms, LUTs and interpolation in one call, all timed as the apply stage.
+// Where perf_event_open allows it, the same number of extra runs reads
+// cycles, instructions, LLC misses and branch misses of every thread around
+// each stage; their per-run means, IPC and bytes per cycle are reported next
+// to the times. Counters are summed over threads, so bytes per cycle is per
+// core. The timed runs never read counters.
+// Usage: stage_bench [options], see usage()
+
+#define MAX_VALUES 32
+
+enum {
+    STAGE_DECODE,
+    STAGE_HISTOGRAM,
+    STAGE_CDF,
+    STAGE_APPLY,
+    STAGE_ENCODE,
+    STAGE_TOTAL,
+    STAGE_COUNT
+};
+
+static const char *const stageNames[STAGE_COUNT] = {"decode", "histogram", "cdf", "apply", "encode", "total"};
+static const char *const patternNames[] = {"uniform", "gradient", "constant", "natural"};
+#define PATTERN_COUNT 4
+
+// Index after the library backends in -b, for histeqCLAHE()
+#define BACKEND_CLAHE HISTEQ_BACKEND_COUNT
+
+enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_LLC_MISSES,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_COUNT
+};
+
+static const char *const counterNames[COUNTER_COUNT] = {"cycles", "instructions", "llc_misses", "branch_misses"};
+static const unsigned long long counterEvents[COUNTER_COUNT] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES,
+    PERF_COUNT_HW_BRANCH_MISSES
+};
+
+#define MAX_COUNTER_THREADS 1024
+
+// One counter group per thread of the process, led by the cycle counter.
+// `available` is decided on the first thread: an event the CPU or the
+// hypervisor does not provide is left out, and without cycles there are no
+// counters at all.
+typedef struct {
+    int threads;
+    int leader[MAX_COUNTER_THREADS];
+    int members[MAX_COUNTER_THREADS][COUNTER_COUNT];
+    int available[COUNTER_COUNT];
+} Counters;
+
+// -1 until the first attempt, then 0 or 1
+static int countersUsable = -1;
+static int countersAvailable[COUNTER_COUNT];
+
+typedef struct {
+    const char *pattern;
+    double megapixels;
+    int width;
+    int height;
+    int components;
+    const char *backend;
+    int threads;
+    int repetitions;
+    double median[STAGE_COUNT];
+    double p99[STAGE_COUNT];
+    double min[STAGE_COUNT];
+    size_t jpegBytes;
+    size_t outputBytes;
+    int counted;                                // counters below are valid
+    double counts[STAGE_COUNT][COUNTER_COUNT];  // per-run means, all threads
+} Result;
+
+static void usage(const char *program) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -s LIST   image sizes in megapixels (2^20 pixels), e.g. 1,16,100,400 (default: 1,4,16)\n"
+            "  -p LIST   patterns: uniform, gradient, constant, natural (default: all)\n"
+            "  -c LIST   components, 1 (gray) and/or 3 (RGB) (default: 1,3)\n"
+            "  -b LIST   backends: scalar, openmp, simd, clahe (default: all)\n"
+            "  -t LIST   OpenMP thread counts for openmp and clahe (default: 1 and the number of cores)\n"
+            "  -r N      timed runs per configuration (default: 10)\n"
+            "  -w N      warm-up runs per configuration (default: 2)\n"
+            "  -f FORMAT csv or json (default: csv)\n"
+            "  -o FILE   write results to FILE instead of stdout\n"
+            "  -n        no hardware counters, only the timed runs\n",
+            program);
+}
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static int openEvent(int event, pid_t thread, int group) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = counterEvents[event];
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    // User space only, which perf_event_paranoid 2 still allows
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(SYS_perf_event_open, &attr, thread, -1, group, 0);
+}
+
+static void closeCounters(Counters *counters) {
+    for (int t = 0; t < counters->threads; t++) {
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            if (counters->members[t][c] >= 0) {
+                close(counters->members[t][c]);
+            }
+        }
+    }
+    counters->threads = 0;
+}
+
+// Opens a group on every thread the process has now, so it has to run after
+// the OpenMP team has been created. Returns 0, or -1 when there are no
+// counters; the first failure is reported once.
+static int openCounters(Counters *counters) {
+    counters->threads = 0;
+    if (countersUsable == 0) {
+        return -1;
+    }
+    DIR *tasks = opendir("/proc/self/task");
+    if (tasks == NULL) {
+        countersUsable = 0;
+        return -1;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(tasks)) != NULL && counters->threads < MAX_COUNTER_THREADS) {
+        pid_t thread = (pid_t)atoi(entry->d_name);
+        if (thread <= 0) {
+            continue;
+        }
+        int t = counters->threads;
+        int leader = openEvent(COUNTER_CYCLES, thread, -1);
+        if (leader < 0) {
+            if (countersUsable < 0) {
+                fprintf(stderr, "Hardware counters unavailable (perf_event_open: %s); reporting times only\n", strerror(errno));
+                countersUsable = 0;
+                break;
+            }
+            continue;   // the thread has exited since
+        }
+        counters->leader[t] = leader;
+        counters->members[t][COUNTER_CYCLES] = leader;
+        for (int c = COUNTER_CYCLES + 1; c < COUNTER_COUNT; c++) {
+            counters->members[t][c] = -1;
+            if (countersUsable < 0 || countersAvailable[c]) {
+                counters->members[t][c] = openEvent(c, thread, leader);
+            }
+            if (countersUsable < 0) {
+                countersAvailable[c] = counters->members[t][c] >= 0;
+                if (!countersAvailable[c]) {
+                    fprintf(stderr, "Counter %s unavailable (perf_event_open: %s)\n", counterNames[c], strerror(errno));
+                }
+            }
+        }
+        countersAvailable[COUNTER_CYCLES] = 1;
+        countersUsable = 1;
+        counters->threads++;
+    }
+    closedir(tasks);
+    memcpy(counters->available, countersAvailable, sizeof(countersAvailable));
+    return (counters->threads > 0) ? 0 : -1;
+}
+
+// Sum over threads, scaled up if the kernel had to multiplex the group
+static void readCounters(const Counters *counters, unsigned long long values[COUNTER_COUNT]) {
+    memset(values, 0, COUNTER_COUNT * sizeof(unsigned long long));
+    for (int t = 0; t < counters->threads; t++) {
+        // nr, time enabled, time running, then the values in group order
+        unsigned long long buffer[3 + COUNTER_COUNT];
+        if (read(counters->leader[t], buffer, sizeof(buffer)) < (ssize_t)(3 * sizeof(unsigned long long)) || buffer[2] == 0) {
+            continue;
+        }
+        double scale = (double)buffer[1] / buffer[2];
+        int index = 3;
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            if (counters->members[t][c] >= 0 && index < 3 + (int)buffer[0]) {
+                values[c] += (unsigned long long)(buffer[index++] * scale);
+            }
+        }
+    }
+}
+
+// Comma-separated numbers; returns how many were read, or -1
+static int parseNumbers(const char *text, double values[MAX_VALUES]) {
+    int count = 0;
+    const char *p = text;
+    while (*p != '\0') {
+        char *end;
+        double value = strtod(p, &end);
+        if (end == p || value <= 0 || count == MAX_VALUES) {
+            return -1;
+        }
+        values[count++] = value;
+        p = (*end == ',') ? end + 1 : end;
+        if (*end != ',' && *end != '\0') {
+            return -1;
+        }
+    }
+    return count;
+}
+
+// Comma-separated names, each of which must be in `known`; stores indices
+static int parseNames(const char *text, const char *const *known, int knownCount, int indices[MAX_VALUES]) {
+    int count = 0;
+    const char *p = text;
+    while (*p != '\0') {
+        size_t length = strcspn(p, ",");
+        int found = -1;
+        for (int i = 0; i < knownCount; i++) {
+            if (strlen(known[i]) == length && strncmp(known[i], p, length) == 0) {
+                found = i;
+            }
+        }
+        if (found < 0 || count == MAX_VALUES) {
+            return -1;
+        }
+        indices[count++] = found;
+        p += length + (p[length] == ',');
+    }
+    return count;
+}
+
+static void fillImage(unsigned char *data, int width, int height, int components, const char *pattern) {
+    #pragma omp parallel for
+    for (int y = 0; y < height; y++) {
+        unsigned int seed = 12345u + 7919u * (unsigned int)y;
+        for (int x = 0; x < width; x++) {
+            for (int c = 0; c < components; c++) {
+                size_t index = ((size_t)y * width + x) * components + c;
+                seed = seed * 1103515245u + 12345u;
+                if (strcmp(pattern, "uniform") == 0) {
+                    data[index] = (unsigned char)(seed >> 24);
+                } else if (strcmp(pattern, "gradient") == 0) {
+                    data[index] = (unsigned char)(((long long)x * 255 / (width > 1 ? width - 1 : 1) + c * 40) & 255);
+                } else if (strcmp(pattern, "natural") == 0) {
+                    // Slow gradients with a little sensor noise: long runs of nearby values
+                    double value = 128 + 60 * sin(x / 97.0 + c) * cos(y / 53.0) + (int)(seed >> 30) - 2;
+                    data[index] = (unsigned char)value;
+                } else {
+                    data[index] = 200;
+                }
+            }
+        }
+    }
+}
+
+static int compareDoubles(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Sorts `samples`; the p99 is the nearest-rank one, which is the maximum
+// below 100 runs
+static void summarize(double *samples, int count, double *median, double *p99, double *min) {
+    qsort(samples, count, sizeof(double), compareDoubles);
+    *median = (count % 2) ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+    int rank = (int)ceil(0.99 * count);
+    *p99 = samples[(rank > 0 ? rank : 1) - 1];
+    *min = samples[0];
+}
+
+// Time and, when `counters` is not NULL, counter values at a stage boundary
+typedef struct {
+    double time;
+    unsigned long long counts[COUNTER_COUNT];
+} Mark;
+
+static void mark(const Counters *counters, Mark *m) {
+    m->time = nowSeconds();
+    if (counters != NULL) {
+        readCounters(counters, m->counts);
+    }
+}
+
+// One decode -> histogram -> LUT -> apply -> encode run; stage times in
+// seconds, and counter deltas per stage if `counters` is not NULL. A NULL
+// backend runs CLAHE in the apply stage instead.
+static int runPipeline(const HistEqBackend *backend, const HistEqMemoryBuffer *jpeg, HistEqMemoryBuffer *output,
+                       unsigned char *gray, const Counters *counters, double times[STAGE_COUNT],
+                       unsigned long long counts[STAGE_COUNT][COUNTER_COUNT]) {
+    unsigned char *data = NULL;
+    int width, height, color_space;
+    int histogram[HISTEQ_BINS];
+    unsigned char lut[HISTEQ_BINS];
+    Mark marks[STAGE_COUNT];
+
+    mark(counters, &marks[0]);
+    if (histeqReadJPEGMemory(jpeg->data, jpeg->size, &data, &width, &height, &color_space) != 0) {
+        return -1;
+    }
+    size_t pixels = (size_t)width * height;
+    int components = (color_space == JCS_GRAYSCALE) ? 1 : 3;
+
+    // RGB goes through the fused luma kernels, as in histeqEqualize()
+    mark(counters, &marks[1]);
+    if (backend == NULL) {
+        // CLAHE has no separate histogram and LUT stages; they take no time
+        static const HistEqCLAHEParams clahe = {HISTEQ_CLAHE_TILES, HISTEQ_CLAHE_TILES, HISTEQ_CLAHE_CLIP_LIMIT};
+        marks[2] = marks[3] = marks[1];
+        if (histeqCLAHE(data, width, height, components, &clahe) != 0) {
+            free(data);
+            return -1;
+        }
+    } else {
+        if (components == 3) {
+            backend->lumaHistogram(data, gray, pixels, histogram);
+        } else {
+            backend->computeHistogram(data, pixels, 1, histogram);
+        }
+        mark(counters, &marks[2]);
+        histeqBuildLUT(histogram, (long long)pixels, lut);
+        mark(counters, &marks[3]);
+        if (components == 3) {
+            backend->applyLUTGray(gray, data, pixels, lut);
+        } else {
+            backend->applyLUT(data, pixels, 1, lut);
+        }
+    }
+    mark(counters, &marks[4]);
+    output->size = 0;
+    int status = histeqWriteJPEGMemory(output, data, width, height, color_space);
+    mark(counters, &marks[5]);
+    free(data);
+
+    // Stage s runs from mark s to mark s + 1; the total from the first to the last
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        const Mark *begin = (s == STAGE_TOTAL) ? &marks[0] : &marks[s];
+        const Mark *end = (s == STAGE_TOTAL) ? &marks[STAGE_TOTAL] : &marks[s + 1];
+        times[s] = end->time - begin->time;
+        if (counters != NULL) {
+            for (int c = 0; c < COUNTER_COUNT; c++) {
+                counts[s][c] = end->counts[c] - begin->counts[c];
+            }
+        }
+    }
+    return status;
+}
+
+static int measure(Result *result, const HistEqBackend *backend, const HistEqMemoryBuffer *jpeg, unsigned char *gray,
+                   int warmups, int repetitions, int useCounters) {
+    HistEqMemoryBuffer output = {NULL, 0, 0, 1};
+    double *samples = (double *)malloc((size_t)repetitions * STAGE_COUNT * sizeof(double));
+    if (samples == NULL) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+
+    omp_set_num_threads(result->threads);
+    for (int r = 0; r < warmups + repetitions; r++) {
+        double times[STAGE_COUNT];
+        if (runPipeline(backend, jpeg, &output, gray, NULL, times, NULL) != 0) {
+            free(samples);
+            free(output.data);
+            return -1;
+        }
+        if (r >= warmups) {
+            for (int s = 0; s < STAGE_COUNT; s++) {
+                samples[s * repetitions + (r - warmups)] = times[s];
+            }
+        }
+    }
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        summarize(samples + s * repetitions, repetitions, &result->median[s], &result->p99[s], &result->min[s]);
+    }
+    result->repetitions = repetitions;
+    result->jpegBytes = jpeg->size;
+    result->outputBytes = output.size;
+
+    // Separate runs for the counters, so the reads do not show in the times
+    static Counters counters;
+    result->counted = 0;
+    if (useCounters && openCounters(&counters) == 0) {
+        memset(result->counts, 0, sizeof(result->counts));
+        for (int r = 0; r < repetitions; r++) {
+            double times[STAGE_COUNT];
+            unsigned long long counts[STAGE_COUNT][COUNTER_COUNT];
+            if (runPipeline(backend, jpeg, &output, gray, &counters, times, counts) != 0) {
+                break;
+            }
+            for (int s = 0; s < STAGE_COUNT; s++) {
+                for (int c = 0; c < COUNTER_COUNT; c++) {
+                    result->counts[s][c] += (double)counts[s][c] / repetitions;
+                }
+            }
+            result->counted = (r == repetitions - 1);
+        }
+        closeCounters(&counters);
+    }
+
+    free(samples);
+    free(output.data);
+    return 0;
+}
+
+// Bytes a stage has to read and write at least: the compressed and decoded
+// image for the codecs, the pixels (and for RGB the gray plane) for the
+// kernels, the tables for the CDF
+static double stageBytes(const Result *result, int stage) {
+    double pixels = (double)result->width * result->height;
+    double image = pixels * result->components;
+    double kernel = (result->components == 3) ? 4 * pixels : 2 * pixels;
+    switch (stage) {
+        case STAGE_DECODE: return result->jpegBytes + image;
+        case STAGE_HISTOGRAM: return (result->components == 3) ? kernel : pixels;
+        case STAGE_CDF: return HISTEQ_BINS * (sizeof(int) + 1);
+        case STAGE_APPLY: return kernel;
+        case STAGE_ENCODE: return image + result->outputBytes;
+        default:
+            break;
+    }
+    double total = 0;
+    for (int s = 0; s < STAGE_TOTAL; s++) {
+        total += stageBytes(result, s);
+    }
+    return total;
+}
+
+// Megapixels per second; 0 for stages a run skips, such as the histogram of CLAHE
+static double throughput(double pixels, double seconds) {
+    return (seconds > 0) ? pixels / seconds / 1e6 : 0;
+}
+
+static void printCSVHeader(FILE *out) {
+    fprintf(out, "pattern,megapixels,width,height,components,backend,threads,stage,runs,median_ms,p99_ms,min_ms,median_mpx_per_s,"
+            "cycles,instructions,llc_misses,branch_misses,ipc,bytes_per_cycle\n");
+}
+
+static void printCSV(FILE *out, const Result *result) {
+    double pixels = (double)result->width * result->height;
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        fprintf(out, "%s,%g,%d,%d,%d,%s,%d,%s,%d,%.4f,%.4f,%.4f,%.1f", result->pattern, result->megapixels, result->width,
+                result->height, result->components, result->backend, result->threads, stageNames[s], result->repetitions,
+                result->median[s] * 1e3, result->p99[s] * 1e3, result->min[s] * 1e3, throughput(pixels, result->median[s]));
+        // Empty fields for counters that were not read
+        const double *counts = result->counts[s];
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            if (result->counted && countersAvailable[c]) {
+                fprintf(out, ",%.0f", counts[c]);
+            } else {
+                fprintf(out, ",");
+            }
+        }
+        if (result->counted && counts[COUNTER_CYCLES] > 0) {
+            if (countersAvailable[COUNTER_INSTRUCTIONS]) {
+                fprintf(out, ",%.3f", counts[COUNTER_INSTRUCTIONS] / counts[COUNTER_CYCLES]);
+            } else {
+                fprintf(out, ",");
+            }
+            fprintf(out, ",%.3f\n", stageBytes(result, s) / counts[COUNTER_CYCLES]);
+        } else {
+            fprintf(out, ",,\n");
+        }
+    }
+}
+
+static void printJSON(FILE *out, const Result *result, int first) {
+    double pixels = (double)result->width * result->height;
+    fprintf(out, "%s  {\"pattern\": \"%s\", \"megapixels\": %g, \"width\": %d, \"height\": %d, \"components\": %d, "
+            "\"backend\": \"%s\", \"threads\": %d, \"runs\": %d, \"stages\": {",
+            first ? "" : ",\n", result->pattern, result->megapixels, result->width, result->height, result->components,
+            result->backend, result->threads, result->repetitions);
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        fprintf(out, "%s\"%s\": {\"median_ms\": %.4f, \"p99_ms\": %.4f, \"min_ms\": %.4f, \"median_mpx_per_s\": %.1f",
+                s ? ", " : "", stageNames[s], result->median[s] * 1e3, result->p99[s] * 1e3, result->min[s] * 1e3,
+                throughput(pixels, result->median[s]));
+        // Counters that were not read are left out
+        const double *counts = result->counts[s];
+        for (int c = 0; c < COUNTER_COUNT; c++) {
+            if (result->counted && countersAvailable[c]) {
+                fprintf(out, ", \"%s\": %.0f", counterNames[c], counts[c]);
+            }
+        }
+        if (result->counted && counts[COUNTER_CYCLES] > 0) {
+            if (countersAvailable[COUNTER_INSTRUCTIONS]) {
+                fprintf(out, ", \"ipc\": %.3f", counts[COUNTER_INSTRUCTIONS] / counts[COUNTER_CYCLES]);
+            }
+            fprintf(out, ", \"bytes_per_cycle\": %.3f", stageBytes(result, s) / counts[COUNTER_CYCLES]);
+        }
+        fprintf(out, "}");
+    }
+    fprintf(out, "}}");
+}
+
+int main(int argc, char *argv[]) {
+    double sizes[MAX_VALUES] = {1, 4, 16};
+    int sizeCount = 3;
+    int patterns[MAX_VALUES] = {0, 1, 2, 3};
+    int patternCount = PATTERN_COUNT;
+    double componentValues[MAX_VALUES] = {1, 3};
+    int componentCount = 2;
+    int backends[MAX_VALUES] = {HISTEQ_BACKEND_SCALAR, HISTEQ_BACKEND_OPENMP, HISTEQ_BACKEND_SIMD, BACKEND_CLAHE};
+    int backendCount = HISTEQ_BACKEND_COUNT + 1;
+    double threadValues[MAX_VALUES] = {1, omp_get_max_threads()};
+    int threadCount = (omp_get_max_threads() > 1) ? 2 : 1;
+    int repetitions = 10;
+    int warmups = 2;
+    int json = 0;
+    int useCounters = 1;
+    const char *outputFile = NULL;
+    const char *backendNames[HISTEQ_BACKEND_COUNT + 1];
+    for (int i = 0; i < HISTEQ_BACKEND_COUNT; i++) {
+        backendNames[i] = histeqGetBackend(i)->name;
+    }
+    backendNames[BACKEND_CLAHE] = "clahe";
+
+    int option;
+    while ((option = getopt(argc, argv, "s:p:c:b:t:r:w:f:o:nh")) != -1) {
+        int count = 0;
+        switch (option) {
+            case 's': count = sizeCount = parseNumbers(optarg, sizes); break;
+            case 'p': count = patternCount = parseNames(optarg, patternNames, PATTERN_COUNT, patterns); break;
+            case 'c': count = componentCount = parseNumbers(optarg, componentValues); break;
+            case 'b': count = backendCount = parseNames(optarg, backendNames, HISTEQ_BACKEND_COUNT + 1, backends); break;
+            case 't': count = threadCount = parseNumbers(optarg, threadValues); break;
+            case 'r': count = repetitions = atoi(optarg); break;
+            case 'w': warmups = atoi(optarg); count = (warmups >= 0); break;
+            case 'f':
+                json = strcmp(optarg, "json") == 0;
+                count = json || strcmp(optarg, "csv") == 0;
+                break;
+            case 'o': outputFile = optarg; count = 1; break;
+            case 'n': useCounters = 0; count = 1; break;
+            default:
+                usage(argv[0]);
+                return (option == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        if (count < 1) {
+            fprintf(stderr, "Invalid value '%s' for -%c\n", optarg, option);
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    for (int i = 0; i < componentCount; i++) {
+        if (componentValues[i] != 1 && componentValues[i] != 3) {
+            fprintf(stderr, "Components must be 1 or 3\n");
+            return EXIT_FAILURE;
+        }
+    }
+
+    FILE *out = stdout;
+    if (outputFile != NULL && (out = fopen(outputFile, "w")) == NULL) {
+        perror(outputFile);
+        return EXIT_FAILURE;
+    }
+    if (json) {
+        fprintf(out, "[\n");
+    } else {
+        printCSVHeader(out);
+    }
+
+    int first = 1;
+    for (int s = 0; s < sizeCount; s++) {
+        // Square-ish, in whole MCUs, and within JPEG's 65500 pixel limit
+        double target = sizes[s] * 1024 * 1024;
+        int width = ((int)sqrt(target) + 15) / 16 * 16;
+        int height = (int)((target + width - 1) / width);
+        if (width > 65500 || height > 65500) {
+            fprintf(stderr, "Skipping %g MP: larger than a JPEG can be\n", sizes[s]);
+            continue;
+        }
+        size_t pixels = (size_t)width * height;
+
+        for (int c = 0; c < componentCount; c++) {
+            int components = (int)componentValues[c];
+            unsigned char *image = (unsigned char *)malloc(pixels * components);
+            unsigned char *gray = (unsigned char *)malloc(pixels);
+            if (image == NULL || gray == NULL) {
+                fprintf(stderr, "Skipping %g MP with %d components: out of memory\n", sizes[s], components);
+                free(image);
+                free(gray);
+                continue;
+            }
+
+            for (int p = 0; p < patternCount; p++) {
+                const char *pattern = patternNames[patterns[p]];
+                HistEqMemoryBuffer jpeg = {NULL, 0, 0, 1};
+                fillImage(image, width, height, components, pattern);
+                if (histeqWriteJPEGMemory(&jpeg, image, width, height, (components == 1) ? JCS_GRAYSCALE : JCS_RGB) != 0) {
+                    free(jpeg.data);
+                    continue;
+                }
+
+                for (int b = 0; b < backendCount; b++) {
+                    const HistEqBackend *backend = (backends[b] == BACKEND_CLAHE) ? NULL : histeqGetBackend(backends[b]);
+                    int threaded = backends[b] == HISTEQ_BACKEND_OPENMP || backends[b] == BACKEND_CLAHE;
+                    int threadRuns = threaded ? threadCount : 1;
+                    for (int t = 0; t < threadRuns; t++) {
+                        Result result = {pattern, sizes[s], width, height, components, backendNames[backends[b]],
+                                         threaded ? (int)threadValues[t] : 1, 0, {0}, {0}, {0}, 0, 0, 0, {{0}}};
+                        fprintf(stderr, "%s %g MP x%d %s %d thread(s)\n", pattern, sizes[s], components, result.backend, result.threads);
+                        if (measure(&result, backend, &jpeg, gray, warmups, repetitions, useCounters) != 0) {
+                            continue;
+                        }
+                        if (json) {
+                            printJSON(out, &result, first);
+                        } else {
+                            printCSV(out, &result);
+                        }
+                        first = 0;
+                        fflush(out);
+                    }
+                }
+                free(jpeg.data);
+            }
+            free(image);
+            free(gray);
+        }
+    }
+
+    if (json) {
+        fprintf(out, "\n]\n");
+    }
+    if (out != stdout) {
+        fclose(out);
+    }
+    return EXIT_SUCCESS;
+}
@@ -1,117 +1,49 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <jpeglib.h>
+#include "../libhisteq/histeq.h"
 
-void readJPEG(const char *filename, unsigned char **data, int *width, int *height) {
-    struct jpeg_decompress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    FILE *file = fopen(filename, "rb");
-    if (file == NULL) {
-        perror("Error opening file");
-        exit(EXIT_FAILURE);
-    }
-
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_decompress(&cinfo);
-    jpeg_stdio_src(&cinfo, file);
-    jpeg_read_header(&cinfo, TRUE);
-    jpeg_start_decompress(&cinfo);
-
-    *width = cinfo.output_width;
-    *height = cinfo.output_height;
-    int row_stride = cinfo.output_width * cinfo.output_components;
-
-    *data = (unsigned char *)malloc(row_stride * cinfo.output_height);
-    unsigned char *row_pointer[1];
-    while (cinfo.output_scanline < cinfo.output_height) {
-        row_pointer[0] = *data + (cinfo.output_scanline) * row_stride;
-        jpeg_read_scanlines(&cinfo, row_pointer, 1);
-    }
-
-    jpeg_finish_decompress(&cinfo);
-    jpeg_destroy_decompress(&cinfo);
-    fclose(file);
+void histogramEqualization(unsigned char *data, int width, int height) {
+    histeqEqualize(histeqGetBackend(HISTEQ_BACKEND_SCALAR), data, width, height, 3, NULL, NULL);
 }
 
-void writeJPEG(const char *filename, unsigned char *data, int width, int height) {
-    struct jpeg_compress_struct cinfo;
-    struct jpeg_error_mgr jerr;
-    FILE *file = fopen(filename, "wb");
-    if (file == NULL) {
-        perror("Error opening file");
-        exit(EXIT_FAILURE);
-    }
-
-    cinfo.err = jpeg_std_error(&jerr);
-    jpeg_create_compress(&cinfo);
-    jpeg_stdio_dest(&cinfo, file);
-
-    cinfo.image_width = width;
-    cinfo.image_height = height;
-    cinfo.input_components = 3; // 3 for RGB
-    cinfo.in_color_space = JCS_RGB;
-    jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, 75, TRUE); // Quality 75
-
-    jpeg_start_compress(&cinfo, TRUE);
-    int row_stride = width * 3;
-    while (cinfo.next_scanline < cinfo.image_height) {
-        unsigned char *row_pointer[1];
-        row_pointer[0] = data + (cinfo.next_scanline) * row_stride;
-        jpeg_write_scanlines(&cinfo, row_pointer, 1);
-    }
-
-    jpeg_finish_compress(&cinfo);
-    jpeg_destroy_compress(&cinfo);
-    fclose(file);
+// Equalizes in one of the colour-preserving modes of histeqEqualizeColour()
+int colourHistogramEqualization(unsigned char *data, int width, int height, HistEqColourMode mode) {
+    return histeqEqualizeColour(histeqGetBackend(HISTEQ_BACKEND_OPENMP), data, width, height, mode, NULL, NULL);
 }
 
-void histogramEqualization(unsigned char *data, int width, int height) {
-    int histogram[256] = {0};
-    int cumulativeHistogram[256] = {0};
-    unsigned char newPixelValue[256];
-
-    // Calculate histogram
-    int rowSize = width * 3;
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < rowSize; j += 3) {
-            unsigned char gray = (data[i * rowSize + j] * 0.299) + (data[i * rowSize + j + 1] * 0.587) + (data[i * rowSize + j + 2] * 0.114);
-            histogram[gray]++;
-        }
-    }
-
-    // Calculate cumulative histogram
-    cumulativeHistogram[0] = histogram[0];
-    for (int i = 1; i < 256; i++) {
-        cumulativeHistogram[i] = cumulativeHistogram[i - 1] + histogram[i];
-        newPixelValue[i] = (unsigned char)(((float)cumulativeHistogram[i] - cumulativeHistogram[0]) / (width * height - 1) * 255);
+// Usage: colour_images [gray|rgb|hsv|lab|ycbcr]; gray, the default, writes the
+// equalized luma to all three channels
+int main(int argc, char *argv[]) {
+    HistEqColourMode mode = HISTEQ_COLOUR_GRAY;
+    if (argc > 1 && histeqFindColourMode(argv[1], &mode) != 0) {
+        fprintf(stderr, "Unknown colour mode '%s' (gray, rgb, hsv, lab or ycbcr)\n", argv[1]);
+        return EXIT_FAILURE;
     }
 
-    // Apply histogram equalization
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < rowSize; j += 3) {
-            unsigned char gray = (data[i * rowSize + j] * 0.299) + (data[i * rowSize + j + 1] * 0.587) + (data[i * rowSize + j + 2] * 0.114);
-            unsigned char equalizedValue = newPixelValue[gray];
-            data[i * rowSize + j] = equalizedValue;         // Red
-            data[i * rowSize + j + 1] = equalizedValue;     // Green
-            data[i * rowSize + j + 2] = equalizedValue;     // Blue
-        }
-    }
-}
-
-int main() {
     char filename[256];
     printf("Enter the JPEG image file name: ");
     scanf("%255s", filename);
 
     unsigned char *data = NULL;
     int width, height;
+    int color_space;
 
-    readJPEG(filename, &data, &width, &height);
+    readJPEG(filename, &data, &width, &height, &color_space);
+    if (color_space != JCS_RGB) {
+        fprintf(stderr, "Expected a colour (RGB) JPEG image\n");
+        free(data);
+        return EXIT_FAILURE;
+    }
 
-    histogramEqualization(data, width, height);
+    if (mode == HISTEQ_COLOUR_GRAY) {
+        histogramEqualization(data, width, height);
+    } else if (colourHistogramEqualization(data, width, height, mode) != 0) {
+        free(data);
+        return EXIT_FAILURE;
+    }
 
-    writeJPEG("equalized_image.jpg", data, width, height);
+    writeJPEG("equalized_image.jpg", data, width, height, color_space);
 
     free(data);
     printf("Equalized image saved as 'equalized_image.jpg'\n");
@@ -0,0 +1,36 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../libhisteq/histeq.h"
+
+// Equalizes 16-bit (or 12-bit, 10-bit, ...) images, e.g. microscopy PNGs,
+// on a histogram with one bin per value. Returns the histogram bits used.
+int histogramEqualization16(unsigned short *data, int width, int height, int components, int outputBits) {
+    return histeqEqualize16(histeqGetBackend(HISTEQ_BACKEND_OPENMP), data, width, height, components, outputBits);
+}
+
+int main(int argc, char *argv[]) {
+    // The output depth defaults to the full 16 bits of the PNG
+    int outputBits = (argc > 1) ? atoi(argv[1]) : HISTEQ_WIDE_MAX_BITS;
+    char filename[256];
+    printf("Enter the image file name (PNG, PNM or PSD, up to 16 bits): ");
+    scanf("%255s", filename);
+
+    unsigned short *data = NULL;
+    int width, height;
+    int components;
+
+    if (histeqReadImage16(filename, &data, &width, &height, &components) != 0) {
+        return EXIT_FAILURE;
+    }
+
+    int bits = histogramEqualization16(data, width, height, components, outputBits);
+    if (bits < 0 || histeqWritePNG16("equalized_image.png", data, width, height, components) != 0) {
+        free(data);
+        return EXIT_FAILURE;
+    }
+
+    free(data);
+    printf("Equalized %d-bit data into 'equalized_image.png'\n", bits);
+
+    return 0;
+}
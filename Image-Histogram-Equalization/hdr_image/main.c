@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <jpeglib.h>
+#include "../libhisteq/histeq.h"
+
+// Tone maps a floating-point image to 8 bits by equalizing its log luminance
+int histogramEqualizationHDR(const float *data, int width, int height, int bins, unsigned char *output) {
+    return histeqEqualizeHDR(histeqGetBackend(HISTEQ_BACKEND_OPENMP), data, width, height, bins, output);
+}
+
+// Usage: hdr_image [bins] [output.jpg | output.png]
+int main(int argc, char *argv[]) {
+    int bins = (argc > 1) ? atoi(argv[1]) : HISTEQ_HDR_BINS;
+    const char *outputFile = (argc > 2) ? argv[2] : "equalized_image.jpg";
+    char filename[256];
+    printf("Enter the HDR image file name (.hdr, or any 8-bit format): ");
+    scanf("%255s", filename);
+
+    float *data = NULL;
+    int width, height;
+
+    if (histeqReadImageHDR(filename, &data, &width, &height) != 0) {
+        return EXIT_FAILURE;
+    }
+    unsigned char *output = (unsigned char *)malloc((size_t)width * height * 3);
+    if (output == NULL) {
+        perror("Memory allocation failed");
+        free(data);
+        return EXIT_FAILURE;
+    }
+
+    int status = histogramEqualizationHDR(data, width, height, bins, output);
+    free(data);
+    if (status == 0) {
+        size_t length = strlen(outputFile);
+        if (length > 4 && strcmp(outputFile + length - 4, ".png") == 0) {
+            status = histeqWritePNG(outputFile, output, width, height, 3);
+        } else {
+            status = histeqWriteJPEG(outputFile, output, width, height, JCS_RGB);
+        }
+    }
+    free(output);
+    if (status != 0) {
+        return EXIT_FAILURE;
+    }
+
+    printf("Equalized image saved as '%s'\n", outputFile);
+
+    return 0;
+}
@@ -0,0 +1,224 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "histeq_internal.h"
+
+static const HistEqBackend *const backends[HISTEQ_BACKEND_COUNT] = {
+    &histeqScalarBackend,
+    &histeqOpenMPBackend,
+    &histeqSIMDBackend
+};
+
+HistEqLumaMode histeqLumaMode = HISTEQ_LUMA_EXACT;
+
+void histeqSetLumaMode(HistEqLumaMode mode) {
+    histeqLumaMode = mode;
+}
+
+HistEqLumaMode histeqGetLumaMode(void) {
+    return histeqLumaMode;
+}
+
+// -1 until set or read from the environment
+static int validation = -1;
+
+void histeqSetValidation(int enabled) {
+    validation = enabled;
+}
+
+int histeqGetValidation(void) {
+    if (validation < 0) {
+        validation = getenv("HISTEQ_VALIDATE") != NULL;
+    }
+    return validation;
+}
+
+const HistEqBackend *histeqGetBackend(HistEqBackendId id) {
+    if (id < 0 || id >= HISTEQ_BACKEND_COUNT) {
+        return NULL;
+    }
+    return backends[id];
+}
+
+const HistEqBackend *histeqFindBackend(const char *name) {
+    for (int i = 0; i < HISTEQ_BACKEND_COUNT; i++) {
+        if (strcmp(backends[i]->name, name) == 0) {
+            return backends[i];
+        }
+    }
+    return NULL;
+}
+
+void histeqComputeHistogram(const HistEqBackend *backend, const unsigned char *data, int width, int height, int components, int histogram[HISTEQ_BINS]) {
+    HISTEQ_TRACE_SCOPE("histogram");
+    backend->computeHistogram(data, (size_t)width * height, components, histogram);
+}
+
+void histeqBuildLUT(const int histogram[HISTEQ_BINS], long long totalPixels, unsigned char lut[HISTEQ_BINS]) {
+    HISTEQ_TRACE_SCOPE("buildLUT");
+
+    // A single pixel has nothing to spread, keep it as is
+    if (totalPixels <= 1) {
+        for (int i = 0; i < HISTEQ_BINS; i++) {
+            lut[i] = (unsigned char)i;
+        }
+        return;
+    }
+
+    // Calculate cumulative histogram
+    long long cumulative = histogram[0];
+    lut[0] = 0;
+    for (int i = 1; i < HISTEQ_BINS; i++) {
+        cumulative += histogram[i];
+        // Without a pixel at 0 the top value maps to N / (N - 1) * 255
+        float mapped = ((float)cumulative - histogram[0]) / (totalPixels - 1) * 255;
+        lut[i] = (unsigned char)(mapped < 255 ? mapped : 255);
+    }
+}
+
+void histeqHistogramFromLUT(const int histogram[HISTEQ_BINS], const unsigned char lut[HISTEQ_BINS], int components,
+                            int histogramAfter[HISTEQ_BINS]) {
+    memset(histogramAfter, 0, HISTEQ_BINS * sizeof(int));
+    for (int v = 0; v < HISTEQ_BINS; v++) {
+        int bin = lut[v];
+        if (components == 3) {
+            // Equalized RGB pixels are gray (L, L, L); bin them the way a re-scan would
+            unsigned char pixel[3] = {lut[v], lut[v], lut[v]};
+            bin = histeqLuma(pixel);
+        }
+        histogramAfter[bin] += histogram[v];
+    }
+}
+
+void histeqCompareHistograms(const int exact[HISTEQ_BINS], long long exactTotal, const int approx[HISTEQ_BINS], long long approxTotal,
+                             double *cdfError, int *lutMaxError, double *lutMeanError) {
+    unsigned char exactLUT[HISTEQ_BINS], approxLUT[HISTEQ_BINS];
+    histeqBuildLUT(exact, exactTotal, exactLUT);
+    histeqBuildLUT(approx, approxTotal, approxLUT);
+
+    long long exactCumulative = 0, approxCumulative = 0;
+    double maxDistance = 0, weightedError = 0;
+    int maxLUT = 0;
+    for (int i = 0; i < HISTEQ_BINS; i++) {
+        exactCumulative += exact[i];
+        approxCumulative += approx[i];
+        double distance = (double)exactCumulative / exactTotal - (double)approxCumulative / approxTotal;
+        if (distance < 0) {
+            distance = -distance;
+        }
+        if (distance > maxDistance) {
+            maxDistance = distance;
+        }
+
+        // Only values that occur in the image can be mapped wrongly
+        int lutError = abs(exactLUT[i] - approxLUT[i]);
+        if (exact[i] > 0 && lutError > maxLUT) {
+            maxLUT = lutError;
+        }
+        weightedError += (double)exact[i] * lutError;
+    }
+
+    *cdfError = maxDistance;
+    *lutMaxError = maxLUT;
+    *lutMeanError = weightedError / exactTotal;
+}
+
+void histeqApplyLUT(const HistEqBackend *backend, unsigned char *data, int width, int height, int components, const unsigned char lut[HISTEQ_BINS]) {
+    HISTEQ_TRACE_SCOPE("applyLUT");
+    backend->applyLUT(data, (size_t)width * height, components, lut);
+}
+
+void histeqCheckHistogramAfter(const int scanned[HISTEQ_BINS], int histogramAfter[HISTEQ_BINS]) {
+    for (int i = 0; i < HISTEQ_BINS; i++) {
+        if (scanned[i] != histogramAfter[i]) {
+            fprintf(stderr, "Histogram validation failed at bin %d: derived %d, scanned %d\n", i, histogramAfter[i], scanned[i]);
+            memcpy(histogramAfter, scanned, HISTEQ_BINS * sizeof(int));
+            return;
+        }
+    }
+}
+
+// Cross-check a derived "after" histogram against a real scan of the image
+static void validateHistogramAfter(const HistEqBackend *backend, const unsigned char *data, int width, int height, int components,
+                                   int histogramAfter[HISTEQ_BINS]) {
+    int scanned[HISTEQ_BINS];
+    histeqComputeHistogram(backend, data, width, height, components, scanned);
+    histeqCheckHistogramAfter(scanned, histogramAfter);
+}
+
+void histeqEqualize(const HistEqBackend *backend, unsigned char *data, int width, int height, int components,
+                    int histogramBefore[HISTEQ_BINS], int histogramAfter[HISTEQ_BINS]) {
+    int histogram[HISTEQ_BINS];
+    unsigned char lut[HISTEQ_BINS];
+    size_t pixels = (size_t)width * height;
+    unsigned char *gray = (components == 3) ? (unsigned char *)malloc(pixels) : NULL;
+
+    if (backend->equalize != NULL && (components == 1 || gray != NULL)) {
+        HISTEQ_TRACE_SCOPE("equalize");
+        backend->equalize(data, gray, pixels, components, histogram, lut);
+        free(gray);
+    } else if (gray != NULL) {
+        {
+            HISTEQ_TRACE_SCOPE("histogram");
+            backend->lumaHistogram(data, gray, pixels, histogram);
+        }
+        histeqBuildLUT(histogram, (long long)pixels, lut);
+        {
+            HISTEQ_TRACE_SCOPE("applyLUT");
+            backend->applyLUTGray(gray, data, pixels, lut);
+        }
+        free(gray);
+    } else {
+        // Grayscale, or no memory for the luma plane
+        histeqComputeHistogram(backend, data, width, height, components, histogram);
+        histeqBuildLUT(histogram, (long long)pixels, lut);
+        histeqApplyLUT(backend, data, width, height, components, lut);
+    }
+
+    if (histogramBefore != NULL) {
+        memcpy(histogramBefore, histogram, sizeof(histogram));
+    }
+    if (histogramAfter != NULL) {
+        histeqHistogramFromLUT(histogram, lut, components, histogramAfter);
+        if (histeqGetValidation()) {
+            validateHistogramAfter(backend, data, width, height, components, histogramAfter);
+        }
+    }
+}
+
+int histeqEqualizePlanar(const HistEqBackend *backend, HistEqPlanarImage *image,
+                         int histogramBefore[HISTEQ_BINS], int histogramAfter[HISTEQ_BINS]) {
+    int histogram[HISTEQ_BINS];
+    unsigned char lut[HISTEQ_BINS];
+    unsigned char *luma = image->planes[0];
+    int stride = image->planeWidth[0];
+    int width, height;
+    if (histeqPlanarLumaSize(image, &width, &height) != 0) {
+        return -1;
+    }
+
+    // Only the visible part of the Y plane counts; the block padding to the
+    // right and below is left out of the histogram
+    memset(histogram, 0, sizeof(histogram));
+    {
+        HISTEQ_TRACE_SCOPE("histogram");
+        for (int y = 0; y < height; y++) {
+            histeqHistogramRow(luma + (size_t)y * stride, width, histogram);
+        }
+    }
+    histeqBuildLUT(histogram, (long long)width * height, lut);
+
+    // The padding gets mapped too, which keeps the edge blocks smooth
+    {
+        HISTEQ_TRACE_SCOPE("applyLUT");
+        backend->applyLUT(luma, (size_t)stride * image->planeHeight[0], 1, lut);
+    }
+
+    if (histogramBefore != NULL) {
+        memcpy(histogramBefore, histogram, sizeof(histogram));
+    }
+    if (histogramAfter != NULL) {
+        histeqHistogramFromLUT(histogram, lut, 1, histogramAfter);
+    }
+    return 0;
+}
@@ -0,0 +1,391 @@
+#ifndef HISTEQ_H
+#define HISTEQ_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define HISTEQ_BINS 256
+
+// Available kernel backends
+typedef enum {
+    HISTEQ_BACKEND_SCALAR = 0,
+    HISTEQ_BACKEND_OPENMP,
+    HISTEQ_BACKEND_SIMD,
+    HISTEQ_BACKEND_COUNT
+} HistEqBackendId;
+
+// How RGB pixels are reduced to the gray value that is binned and equalized.
+// HISTEQ_LUMA_EXACT reproduces the original double expression
+// (R * 0.299 + G * 0.587 + B * 0.114, truncated) for every colour, so output
+// is identical to the original programs. HISTEQ_LUMA_FAST uses 8-bit fixed
+// point, (77R + 150G + 29B) >> 8: it is never more than one level off, and
+// differs on 2,243,405 of the 16,777,216 colours. Gray pixels (v, v, v) map to
+// v in fast mode, while exact mode maps 65 of them to v - 1.
+typedef enum {
+    HISTEQ_LUMA_EXACT = 0,
+    HISTEQ_LUMA_FAST
+} HistEqLumaMode;
+
+#define HISTEQ_LUMA_FAST_R 77
+#define HISTEQ_LUMA_FAST_G 150
+#define HISTEQ_LUMA_FAST_B 29
+
+// Kernel table for one backend. Buffers are flat: `pixels` is width * height
+// and `components` is 1 (grayscale) or 3 (RGB, binned and equalized on luma).
+typedef struct {
+    const char *name;
+    void (*computeHistogram)(const unsigned char *data, size_t pixels, int components, int histogram[HISTEQ_BINS]);
+    void (*applyLUT)(unsigned char *data, size_t pixels, int components, const unsigned char lut[HISTEQ_BINS]);
+
+    // Fused RGB path: one luma pass that fills a gray plane and the histogram,
+    // then one pass that writes lut[gray] to all three channels. The gray plane
+    // is scratch and gets overwritten.
+    void (*lumaHistogram)(const unsigned char *rgb, unsigned char *gray, size_t pixels, int histogram[HISTEQ_BINS]);
+    void (*applyLUTGray)(unsigned char *gray, unsigned char *rgb, size_t pixels, const unsigned char lut[HISTEQ_BINS]);
+
+    // Histogram, LUT and apply in one go, for backends that gain from it (the
+    // OpenMP one forks its threads once per image instead of twice). `gray`
+    // is the scratch plane of the fused RGB path and NULL for grayscale. NULL
+    // runs the kernels above one after the other.
+    void (*equalize)(unsigned char *data, unsigned char *gray, size_t pixels, int components, int histogram[HISTEQ_BINS],
+                     unsigned char lut[HISTEQ_BINS]);
+} HistEqBackend;
+
+// Backend lookup (histeq.c)
+const HistEqBackend *histeqGetBackend(HistEqBackendId id);
+const HistEqBackend *histeqFindBackend(const char *name);
+
+// Luma mode for all backends, HISTEQ_LUMA_EXACT by default (histeq.c)
+void histeqSetLumaMode(HistEqLumaMode mode);
+HistEqLumaMode histeqGetLumaMode(void);
+
+// When enabled, histeqEqualize() also scans the equalized image and reports any
+// bin where the derived "after" histogram disagrees. Off by default; setting
+// the HISTEQ_VALIDATE environment variable turns it on (histeq.c)
+void histeqSetValidation(int enabled);
+int histeqGetValidation(void);
+
+// Equalization stages (histeq.c)
+void histeqComputeHistogram(const HistEqBackend *backend, const unsigned char *data, int width, int height, int components, int histogram[HISTEQ_BINS]);
+void histeqBuildLUT(const int histogram[HISTEQ_BINS], long long totalPixels, unsigned char lut[HISTEQ_BINS]);
+void histeqApplyLUT(const HistEqBackend *backend, unsigned char *data, int width, int height, int components, const unsigned char lut[HISTEQ_BINS]);
+
+// Histogram of the equalized image, derived from the input histogram and the
+// LUT in 256 steps instead of a scan over the image
+void histeqHistogramFromLUT(const int histogram[HISTEQ_BINS], const unsigned char lut[HISTEQ_BINS], int components,
+                            int histogramAfter[HISTEQ_BINS]);
+
+// Error of an approximate histogram against the exact one: the largest
+// distance between their CDFs as a fraction of pixels, and the largest and the
+// pixel-weighted mean difference between the LUTs built from them (histeq.c)
+void histeqCompareHistograms(const int exact[HISTEQ_BINS], long long exactTotal, const int approx[HISTEQ_BINS], long long approxTotal,
+                             double *cdfError, int *lutMaxError, double *lutMeanError);
+
+// Vectorized in-place lookup over a flat 8-bit buffer, dispatched at runtime
+// to AVX-512 VBMI, AVX2 or scalar code (histeq_simd.c)
+void histeqApplyLUTRow(unsigned char *data, size_t count, const unsigned char lut[HISTEQ_BINS]);
+const char *histeqApplyLUTKernelName(void);
+
+// Adds the values of a flat 8-bit buffer to `histogram` using interleaved
+// sub-histograms (histeq_simd.c)
+void histeqHistogramRow(const unsigned char *data, size_t count, int histogram[HISTEQ_BINS]);
+
+// Gray value of each RGB pixel in the current luma mode
+void histeqLumaRow(const unsigned char *rgb, unsigned char *gray, size_t pixels);
+
+// Full histogram -> LUT -> apply pipeline. histogramBefore/histogramAfter may be NULL.
+// RGB images go through the fused luma path, so luma is computed once per pixel.
+void histeqEqualize(const HistEqBackend *backend, unsigned char *data, int width, int height, int components,
+                    int histogramBefore[HISTEQ_BINS], int histogramAfter[HISTEQ_BINS]);
+
+// Streaming equalization for images too large to hold decoded (histeq_io.c).
+// The input is decoded twice, `stripHeight` scanlines at a time: the first pass
+// only builds the histogram, the second applies the LUT and hands each strip
+// straight to the encoder. Memory is O(width * stripHeight) for baseline
+// JPEGs; libjpeg still buffers all coefficients of a progressive input.
+// stripHeight < 1 selects HISTEQ_STRIP_HEIGHT. The input must be a regular
+// file, since it is read twice. Returns 0, or -1 after reporting on stderr.
+#define HISTEQ_STRIP_HEIGHT 64
+
+int histeqEqualizeStreaming(const HistEqBackend *backend, const char *inputFile, const char *outputFile, int stripHeight,
+                            int histogramBefore[HISTEQ_BINS], int histogramAfter[HISTEQ_BINS]);
+
+// The two passes on their own. histeqStreamApplyLUT fills histogramAfter, if
+// not NULL, by scanning the equalized strips.
+int histeqStreamHistogram(const HistEqBackend *backend, const char *filename, int stripHeight,
+                          int histogram[HISTEQ_BINS], int *width, int *height, int *color_space);
+int histeqStreamApplyLUT(const HistEqBackend *backend, const char *inputFile, const char *outputFile, int stripHeight,
+                         const unsigned char lut[HISTEQ_BINS], int histogramAfter[HISTEQ_BINS]);
+
+// Approximate first pass: the histogram of the image decoded at 1/scaleDenom
+// size (2, 4 or 8; 1 is exact), which skips most of the IDCT and colour work.
+// `samples` receives the pixel count of the scaled image, the total to pass to
+// histeqBuildLUT(); width and height are still the full size. How far the
+// result is from the exact one depends on the image; histeqCompareHistograms()
+// measures it.
+int histeqStreamHistogramScaled(const HistEqBackend *backend, const char *filename, int stripHeight, int scaleDenom,
+                                int histogram[HISTEQ_BINS], long long *samples, int *width, int *height, int *color_space);
+
+// JPEG I/O (histeq_io.c). The histeq* versions report errors on stderr and
+// return -1 instead of exiting; readJPEG/writeJPEG exit on failure.
+// Regular files of 64 KB and up are read through mmap and decoded in place;
+// small files, pipes and other unmappable inputs go through stdio.
+int histeqReadJPEG(const char *filename, unsigned char **data, int *width, int *height, int *color_space);
+int histeqWriteJPEG(const char *filename, const unsigned char *data, int width, int height, int color_space);
+void readJPEG(const char *filename, unsigned char **data, int *width, int *height, int *color_space);
+void writeJPEG(const char *filename, unsigned char *data, int width, int height, int color_space);
+void saveHistogramImageJPEG(const int histogram[], const char *filename);
+
+// A JPEG as its stored component planes, before upsampling and colour
+// conversion: Y, Cb, Cr for colour images, Y alone for grayscale. Each plane is
+// planeWidth x planeHeight bytes, padded to whole iMCU rows. width x height is
+// the image size; a plane's visible part is that scaled by its sampling factors
+// (hSamp/vSamp) over the largest ones, so it is smaller for Y when Y is
+// subsampled relative to chroma.
+typedef struct {
+    int width;
+    int height;
+    int components;
+    int color_space;            // JCS_YCbCr or JCS_GRAYSCALE
+    int hSamp[3];
+    int vSamp[3];
+    int planeWidth[3];
+    int planeHeight[3];
+    unsigned char *planes[3];
+} HistEqPlanarImage;
+
+// Raw YCbCr I/O through raw_data_out/raw_data_in (histeq_io.c). Nothing is
+// upsampled or colour converted, and the output keeps the input's chroma
+// subsampling. Release a decoded image with histeqFreePlanar().
+int histeqReadJPEGPlanar(const char *filename, HistEqPlanarImage *image);
+int histeqWriteJPEGPlanar(const char *filename, const HistEqPlanarImage *image);
+void histeqFreePlanar(HistEqPlanarImage *image);
+
+// Equalizes the Y plane only and leaves the chroma planes as they are, so
+// colours keep their hue and saturation (histeq.c). JPEG's Y uses the same
+// 0.299/0.587/0.114 weights as the RGB luma path, rounded instead of truncated.
+// Returns 0, or -1 if plane 0 is smaller than its visible size.
+int histeqEqualizePlanar(const HistEqBackend *backend, HistEqPlanarImage *image,
+                         int histogramBefore[HISTEQ_BINS], int histogramAfter[HISTEQ_BINS]);
+int histeqEqualizeJPEGYCbCr(const HistEqBackend *backend, const char *inputFile, const char *outputFile,
+                            int histogramBefore[HISTEQ_BINS], int histogramAfter[HISTEQ_BINS]);
+
+// Coefficient-level transcoding (histeq_io.c): the input's DCT coefficients
+// are read with jpeg_read_coefficients, only the Y blocks are decoded,
+// equalized and re-quantized with the input's own table, and everything is
+// written back with jpeg_write_coefficients. Cb and Cr are copied verbatim,
+// so they lose nothing and cost only their entropy coding. Open decodes Y
+// and builds its histogram; after Equalize and Write, always Close. Both
+// histograms come from the library's float IDCT, the after one from the
+// re-quantized blocks that are written. A decoder with another IDCT (libjpeg's
+// integer one, say) can land a level away on some pixels.
+typedef struct HistEqTranscoder HistEqTranscoder;
+
+HistEqTranscoder *histeqTranscodeOpen(const char *filename);
+int histeqTranscodeEqualize(const HistEqBackend *backend, HistEqTranscoder *transcoder,
+                            int histogramBefore[HISTEQ_BINS], int histogramAfter[HISTEQ_BINS]);
+int histeqTranscodeWrite(HistEqTranscoder *transcoder, const char *filename);
+void histeqTranscodeClose(HistEqTranscoder *transcoder);
+int histeqTranscodeJPEGLuma(const HistEqBackend *backend, const char *inputFile, const char *outputFile,
+                            int histogramBefore[HISTEQ_BINS], int histogramAfter[HISTEQ_BINS]);
+
+// Contrast-limited adaptive histogram equalization (histeq_clahe.c). The image
+// is split into a tilesX x tilesY grid and each tile gets its own LUT, built
+// like histeqBuildLUT() from a histogram clipped at clipLimit times the mean
+// bin count, with the clipped excess spread over all bins. Each pixel is then
+// mapped through the LUTs of the four nearest tile centres, bilinearly
+// weighted. clipLimit <= 0 turns clipping off (plain adaptive equalization);
+// values around 2 to 4 keep noise in flat regions from being amplified.
+// Tiles, and then rows, are spread over the OpenMP threads.
+#define HISTEQ_CLAHE_TILES 8
+#define HISTEQ_CLAHE_CLIP_LIMIT 2.0
+#define HISTEQ_CLAHE_MAX_TILES 256
+
+typedef struct {
+    int tilesX;
+    int tilesY;
+    double clipLimit;
+} HistEqCLAHEParams;
+
+// One 8-bit plane with rows `stride` bytes apart. The grid is reduced if the
+// plane has fewer pixels than tiles along an axis. Returns 0, or -1 after
+// reporting on stderr.
+int histeqCLAHEPlane(unsigned char *plane, int width, int height, size_t stride, const HistEqCLAHEParams *params);
+
+// Grayscale or RGB. RGB is reduced to luma, and like histeqEqualize() the
+// equalized luma is written to all three channels.
+int histeqCLAHE(unsigned char *data, int width, int height, int components, const HistEqCLAHEParams *params);
+
+// The visible part of the Y plane of a planar image; chroma stays as it is,
+// so colour is kept
+int histeqCLAHEPlanar(HistEqPlanarImage *image, const HistEqCLAHEParams *params);
+
+// Sliding-window adaptive equalization (histeq_ahe.c): every pixel is
+// equalized against the histogram of the (2 * radius + 1)^2 window around it,
+// clipped at the image border, with the mapping of histeqBuildLUT(). Column
+// histograms make the cost per pixel independent of the radius. Row bands are
+// spread over the OpenMP threads; each thread keeps width * 512 bytes of
+// column histograms.
+#define HISTEQ_AHE_MAX_RADIUS 127
+
+int histeqSlidingAHEPlane(unsigned char *plane, int width, int height, size_t stride, int radius);
+
+// Grayscale or RGB; RGB is handled on luma as in histeqCLAHE()
+int histeqSlidingAHE(unsigned char *data, int width, int height, int components, int radius);
+
+// Colour modes for RGB images (histeq_colour.c). HISTEQ_COLOUR_GRAY is
+// histeqEqualize(): luma is equalized and written to all three channels. The
+// others keep colour:
+//   RGB    each channel equalized on its own histogram (hue shifts)
+//   HSV    V = max(R, G, B); all channels are scaled by lut[V] / V, which
+//          keeps hue and saturation
+//   LAB    CIE L* of sRGB (D65) in 256 bins; L* is replaced and a*, b* kept
+//   YCBCR  luma of the current luma mode; its change is added to all three
+//          channels, which keeps Cb and Cr up to clipping at 0 and 255
+typedef enum {
+    HISTEQ_COLOUR_GRAY = 0,
+    HISTEQ_COLOUR_RGB,
+    HISTEQ_COLOUR_HSV,
+    HISTEQ_COLOUR_LAB,
+    HISTEQ_COLOUR_YCBCR,
+    HISTEQ_COLOUR_COUNT
+} HistEqColourMode;
+
+// Mode names are gray, rgb, hsv, lab and ycbcr. histeqFindColourMode returns
+// 0, or -1 for an unknown name.
+const char *histeqColourModeName(HistEqColourMode mode);
+int histeqFindColourMode(const char *name, HistEqColourMode *mode);
+
+// Equalizes interleaved RGB in the given mode, in two passes over blocks of
+// pixels: the colour-space key and its histogram, then the mapping back to
+// RGB. Conversion kernels use AVX2 when available and match the scalar ones
+// exactly; the OpenMP backend splits both passes over its threads. The
+// histograms are of the key, summed over the channels in RGB mode. Returns 0,
+// or -1 after reporting on stderr.
+int histeqEqualizeColour(const HistEqBackend *backend, unsigned char *rgb, int width, int height, HistEqColourMode mode,
+                         int histogramBefore[HISTEQ_BINS], int histogramAfter[HISTEQ_BINS]);
+
+// High bit depth (histeq_wide.c). Samples are 16-bit, and the histogram has
+// 1 << bits bins, where bits is the position of the highest bit set anywhere
+// in the image: 12-bit microscopy data gets 4096 bins, full 16-bit data 65536.
+// Histograms are unsigned int arrays of that many bins; LUTs have one more
+// entry, which histeqBuildLUT16 fills as padding for the vector gather.
+#define HISTEQ_WIDE_MAX_BITS 16
+
+int histeqSignificantBits16(const unsigned short *data, size_t count);
+
+// Adds `count` samples, all below 1 << bits, to `histogram`
+void histeqHistogram16(const unsigned short *data, size_t count, int bits, unsigned int *histogram);
+
+// The mapping of histeqBuildLUT() onto 0 .. (1 << outputBits) - 1
+void histeqBuildLUT16(const unsigned int *histogram, int bits, long long totalPixels, int outputBits, unsigned short *lut);
+void histeqApplyLUT16Row(unsigned short *data, size_t count, const unsigned short *lut);
+
+// Whole-image pipeline for 1 or 3 components; RGB is equalized on luma and
+// written to all three channels like histeqEqualize(). Returns the histogram
+// bits used, or -1 after reporting on stderr.
+int histeqEqualize16(const HistEqBackend *backend, unsigned short *data, int width, int height, int components, int outputBits);
+
+// 16-bit image I/O (histeq_image.c). Reading goes through stb_image: PNG,
+// PNM and PSD keep 16 bits, 8-bit formats are widened. Gray and gray + alpha
+// load as 1 component, everything else as 3; free the data with free().
+// Output is a 16-bit PNG through libpng.
+int histeqReadImage16(const char *filename, unsigned short **data, int *width, int *height, int *components);
+int histeqWritePNG16(const char *filename, const unsigned short *data, int width, int height, int components);
+
+// 8-bit PNG output, 1 or 3 components (histeq_image.c)
+int histeqWritePNG(const char *filename, const unsigned char *data, int width, int height, int components);
+
+// HDR input through stbi_loadf (histeq_image.c): Radiance .hdr as stored,
+// 8-bit formats linearized with a 2.2 gamma. Always 3 floats per pixel;
+// free the data with free().
+int histeqReadImageHDR(const char *filename, float **data, int *width, int *height);
+
+// Floating-point equalization to 8-bit sRGB (histeq_hdr.c). The histogram
+// has `bins` bins over log2 luminance, from the brightest pixel down to the
+// darkest or at most 32 stops below it, and its CDF is built in double. Each
+// pixel's luminance is mapped through the CDF by linear interpolation between
+// bin edges and its colour scaled to match, which keeps hue; channels that
+// end up above 1 are clipped. `output` receives width * height * 3 bytes.
+// Work is done in tiles of a few thousand pixels, with AVX2 kernels when
+// available, spread over threads by the OpenMP backend. Returns 0, or -1
+// after reporting on stderr.
+#define HISTEQ_HDR_BINS 1024
+#define HISTEQ_HDR_MAX_BINS 65536
+
+int histeqEqualizeHDR(const HistEqBackend *backend, const float *rgb, int width, int height, int bins, unsigned char *output);
+
+// Whether histeqReadJPEG() maps large regular files. On by default; HISTEQ_MMAP=0
+// in the environment turns it off, e.g. to compare the two input paths
+void histeqSetMappedInput(int enabled);
+int histeqGetMappedInput(void);
+
+// Output buffer for the in-memory encoder. Set data/capacity to a buffer of
+// your own, or data = NULL and growable = 1 to let the encoder allocate one.
+// A growable buffer must come from malloc and is enlarged with realloc, so
+// data may change; the caller frees it. A fixed buffer that is too small
+// makes the encode fail.
+typedef struct {
+    unsigned char *data;
+    size_t capacity;
+    size_t size;                // bytes of JPEG written
+    int growable;
+} HistEqMemoryBuffer;
+
+// In-memory JPEG I/O (histeq_io.c). The input bytes are decoded in place, so
+// they can come from a network buffer or a histeqMapFile() mapping.
+int histeqReadJPEGMemory(const unsigned char *jpeg, size_t jpegSize, unsigned char **data, int *width, int *height, int *color_space);
+int histeqWriteJPEGMemory(HistEqMemoryBuffer *output, const unsigned char *data, int width, int height, int color_space);
+
+// Equalizes a compressed JPEG buffer into `output` without touching the filesystem
+int histeqEqualizeJPEGMemory(const HistEqBackend *backend, const unsigned char *input, size_t inputSize, HistEqMemoryBuffer *output,
+                             int histogramBefore[HISTEQ_BINS], int histogramAfter[HISTEQ_BINS]);
+
+// Maps a regular file read-only, with sequential read-ahead, for
+// histeqReadJPEGMemory() or other in-memory decoders; release with histeqUnmapFile().
+// Returns -1 without a message, so callers can fall back to stdio or report it.
+int histeqMapFile(const char *filename, const unsigned char **data, size_t *size);
+void histeqUnmapFile(const unsigned char *data, size_t size);
+
+// Stage tracing (histeq_trace.c). HISTEQ_TRACE_SCOPE("name") times the rest
+// of the enclosing block; the library wraps JPEG reads and writes, the
+// histogram, LUT build and apply stages and the histogram plots in scopes.
+// Scopes compile to nothing unless HISTEQ_TRACE is defined, so build the
+// library with -DHISTEQ_TRACE to record them. Each thread records into its own
+// ring of the last HISTEQ_TRACE_EVENTS events without locking; per-stage
+// totals cover every event. The names must be string literals.
+#define HISTEQ_TRACE_EVENTS 16384
+#define HISTEQ_TRACE_STAGES 32
+
+typedef struct {
+    const char *name;
+    unsigned long long start;
+} HistEqTraceScope;
+
+HistEqTraceScope histeqTraceBegin(const char *name);
+void histeqTraceEnd(HistEqTraceScope *scope);
+
+#ifdef HISTEQ_TRACE
+#define HISTEQ_TRACE_JOIN_(a, b) a##b
+#define HISTEQ_TRACE_JOIN(a, b) HISTEQ_TRACE_JOIN_(a, b)
+#define HISTEQ_TRACE_SCOPE(name) \
+    HistEqTraceScope HISTEQ_TRACE_JOIN(histeqTraceScope, __LINE__) __attribute__((cleanup(histeqTraceEnd))) = histeqTraceBegin(name)
+#else
+#define HISTEQ_TRACE_SCOPE(name) ((void)0)
+#endif
+
+// Exports what has been recorded so far: the events still in the rings as
+// Chrome trace JSON (chrome://tracing, Perfetto), and per-stage call counts,
+// total and longest time in Prometheus text format. Returns 0, or -1 after
+// reporting on stderr.
+int histeqTraceWriteChrome(const char *filename);
+int histeqTraceWritePrometheus(const char *filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,276 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include <pthread.h>
+#include "histeq_internal.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HISTEQ_X86 1
+#endif
+
+// Sliding-window adaptive equalization after Perreault and Hebert's
+// constant-time median filter: every column keeps a histogram of the
+// 2r + 1 rows around the current one, and the window histogram moves one
+// column right by adding the column histogram that enters and subtracting
+// the one that leaves. Both are O(1) in the window size. A window holds at
+// most 255 * 255 pixels, so all counts, and any sum of them, fit 16 bits.
+
+typedef unsigned short Bins[HISTEQ_BINS];
+
+// Column histograms per stripe, margins included: 1024 * 512 bytes
+#define AHE_STRIPE_COLUMNS 1024
+
+// Equalizes columns [begin, end) of one row. The column histograms hold the
+// `rows` image rows of the window, and columns[i] is image column
+// firstColumn + i.
+typedef void (*AHERowKernel)(const unsigned char *input, unsigned char *output, int width, int begin, int end, int radius,
+                             int rows, const Bins *columns, int firstColumn);
+
+// Reciprocal of the window size minus one, which only changes near the left
+// and right edges; a division per pixel would cost more than the histogram
+typedef struct {
+    int count;
+    double inverse;
+} WindowScale;
+
+// Output value for a window histogram, the mapping of histeqBuildLUT(): the
+// pixels at or below the value beyond those at 0, spread over 0..255. In a
+// small window without zeros that exceeds 255, so it is clamped. For integers
+// floor((n + 0.5) / d) is floor(n / d), and the half keeps the product clear
+// of the reciprocal's rounding error.
+static inline unsigned char mapValue(int below, int zeros, int count, WindowScale *scale) {
+    if (count != scale->count) {
+        scale->count = count;
+        scale->inverse = (count > 1) ? 1.0 / (count - 1) : 0.0;
+    }
+    int mapped = (int)(((below - zeros) * 255 + 0.5) * scale->inverse);
+    return (unsigned char)(mapped < 255 ? mapped : 255);
+}
+
+static void aheRowScalar(const unsigned char *input, unsigned char *output, int width, int begin, int end, int radius,
+                         int rows, const Bins *columns, int firstColumn) {
+    Bins window;
+    memset(window, 0, sizeof(window));
+    WindowScale scale = {0, 0.0};
+    columns -= firstColumn;
+    for (int x = (begin - radius > 0) ? begin - radius : 0; x <= begin + radius && x < width; x++) {
+        for (int i = 0; i < HISTEQ_BINS; i++) {
+            window[i] += columns[x][i];
+        }
+    }
+
+    for (int x = begin; x < end; x++) {
+        if (x > begin) {
+            if (x + radius < width) {
+                for (int i = 0; i < HISTEQ_BINS; i++) {
+                    window[i] += columns[x + radius][i];
+                }
+            }
+            if (x - radius - 1 >= 0) {
+                for (int i = 0; i < HISTEQ_BINS; i++) {
+                    window[i] -= columns[x - radius - 1][i];
+                }
+            }
+        }
+
+        int left = (x - radius > 0) ? x - radius : 0;
+        int right = (x + radius < width - 1) ? x + radius : width - 1;
+        int below = 0;
+        for (int i = 0; i <= input[x]; i++) {
+            below += window[i];
+        }
+        output[x] = mapValue(below, window[0], rows * (right - left + 1), &scale);
+    }
+}
+
+#ifdef HISTEQ_X86
+// The 256 bins are 16 registers of 16 counts, kept in registers for the
+// whole row. The running sum up to the pixel's value adds whole registers
+// below its register and the masked lanes of its own; since the result
+// fits 16 bits, the lanes can be added with wrap-around.
+__attribute__((target("avx2")))
+static void aheRowAVX2(const unsigned char *input, unsigned char *output, int width, int begin, int end, int radius,
+                       int rows, const Bins *columns, int firstColumn) {
+    const __m256i laneIndex = _mm256_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    __m256i window[16];
+    for (int k = 0; k < 16; k++) {
+        window[k] = _mm256_setzero_si256();
+    }
+    WindowScale scale = {0, 0.0};
+    columns -= firstColumn;
+    for (int x = (begin - radius > 0) ? begin - radius : 0; x <= begin + radius && x < width; x++) {
+        for (int k = 0; k < 16; k++) {
+            window[k] = _mm256_add_epi16(window[k], _mm256_loadu_si256((const __m256i *)(columns[x] + k * 16)));
+        }
+    }
+
+    for (int x = begin; x < end; x++) {
+        if (x > begin) {
+            if (x + radius < width) {
+                const unsigned short *entering = columns[x + radius];
+                for (int k = 0; k < 16; k++) {
+                    window[k] = _mm256_add_epi16(window[k], _mm256_loadu_si256((const __m256i *)(entering + k * 16)));
+                }
+            }
+            if (x - radius - 1 >= 0) {
+                const unsigned short *leaving = columns[x - radius - 1];
+                for (int k = 0; k < 16; k++) {
+                    window[k] = _mm256_sub_epi16(window[k], _mm256_loadu_si256((const __m256i *)(leaving + k * 16)));
+                }
+            }
+        }
+
+        int value = input[x];
+        int block = value >> 4;
+        __m256i sum = _mm256_setzero_si256();
+        for (int k = 0; k < block; k++) {
+            sum = _mm256_add_epi16(sum, window[k]);
+        }
+        // Lanes whose index is at most value & 15
+        __m256i mask = _mm256_cmpgt_epi16(_mm256_set1_epi16((short)((value & 15) + 1)), laneIndex);
+        sum = _mm256_add_epi16(sum, _mm256_and_si256(window[block], mask));
+
+        __m128i half = _mm_add_epi16(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        half = _mm_add_epi16(half, _mm_srli_si128(half, 8));
+        half = _mm_add_epi16(half, _mm_srli_si128(half, 4));
+        half = _mm_add_epi16(half, _mm_srli_si128(half, 2));
+        int below = _mm_extract_epi16(half, 0);
+        int zeros = _mm_extract_epi16(_mm256_castsi256_si128(window[0]), 0);
+
+        int left = (x - radius > 0) ? x - radius : 0;
+        int right = (x + radius < width - 1) ? x + radius : width - 1;
+        output[x] = mapValue(below, zeros, rows * (right - left + 1), &scale);
+    }
+}
+#endif
+
+static AHERowKernel aheRowKernel = aheRowScalar;
+static pthread_once_t kernelResolved = PTHREAD_ONCE_INIT;
+
+static void resolveAHERowKernel(void) {
+#ifdef HISTEQ_X86
+    if (histeqCPUHasAVX2()) {
+        aheRowKernel = aheRowAVX2;
+    }
+#endif
+}
+
+static inline void addRow(Bins *columns, const unsigned char *row, int width) {
+    for (int x = 0; x < width; x++) {
+        columns[x][row[x]]++;
+    }
+}
+
+static inline void removeRow(Bins *columns, const unsigned char *row, int width) {
+    for (int x = 0; x < width; x++) {
+        columns[x][row[x]]--;
+    }
+}
+
+int histeqSlidingAHEPlane(unsigned char *plane, int width, int height, size_t stride, int radius) {
+    if (radius < 1 || radius > HISTEQ_AHE_MAX_RADIUS) {
+        fprintf(stderr, "Sliding-window radius must be between 1 and %d\n", HISTEQ_AHE_MAX_RADIUS);
+        return -1;
+    }
+    if (width < 1 || height < 1) {
+        return 0;
+    }
+
+    // Windows read rows of other bands, so the result goes to a copy
+    int threads = omp_get_max_threads();
+    if (threads > height) {
+        threads = height;
+    }
+    // Vertical stripes keep the column histograms of one stripe and its
+    // margins, about 512 KB, in L2; across a whole wide image they would be
+    // re-read from memory at 1 KB per pixel
+    int stripe = AHE_STRIPE_COLUMNS - 2 * radius;
+    if (stripe < AHE_STRIPE_COLUMNS / 4) {
+        stripe = AHE_STRIPE_COLUMNS / 4;
+    }
+    int stripeColumns = (stripe + 2 * radius < width) ? stripe + 2 * radius : width;
+    unsigned char *output = (unsigned char *)malloc((size_t)width * height);
+    Bins *columns = (Bins *)malloc((size_t)threads * stripeColumns * sizeof(Bins));
+    if (output == NULL || columns == NULL) {
+        perror("Memory allocation failed");
+        free(output);
+        free(columns);
+        return -1;
+    }
+
+    pthread_once(&kernelResolved, resolveAHERowKernel);
+    AHERowKernel kernel = aheRowKernel;
+
+    // One band of rows per thread. For each stripe, a band builds the column
+    // histograms of its first row and then slides them down a row at a time.
+    #pragma omp parallel num_threads(threads)
+    {
+        int thread = omp_get_thread_num();
+        int bands = omp_get_num_threads();
+        int begin = (int)((long long)height * thread / bands);
+        int end = (int)((long long)height * (thread + 1) / bands);
+        Bins *bandColumns = columns + (size_t)thread * stripeColumns;
+
+        for (int x0 = 0; x0 < width; x0 += stripe) {
+            int x1 = (x0 + stripe < width) ? x0 + stripe : width;
+            int firstColumn = (x0 - radius > 0) ? x0 - radius : 0;
+            int lastColumn = (x1 + radius < width) ? x1 + radius : width;
+            int count = lastColumn - firstColumn;
+
+            memset(bandColumns, 0, (size_t)count * sizeof(Bins));
+            int top = (begin - radius > 0) ? begin - radius : 0;
+            int bottom = (begin + radius < height - 1) ? begin + radius : height - 1;
+            for (int y = top; y <= bottom; y++) {
+                addRow(bandColumns, plane + (size_t)y * stride + firstColumn, count);
+            }
+
+            for (int y = begin; y < end; y++) {
+                if (y > begin) {
+                    if (y - radius - 1 >= 0) {
+                        removeRow(bandColumns, plane + (size_t)(y - radius - 1) * stride + firstColumn, count);
+                        top++;
+                    }
+                    if (y + radius < height) {
+                        addRow(bandColumns, plane + (size_t)(y + radius) * stride + firstColumn, count);
+                        bottom++;
+                    }
+                }
+                kernel(plane + (size_t)y * stride, output + (size_t)y * width, width, x0, x1, radius, bottom - top + 1,
+                       (const Bins *)bandColumns, firstColumn);
+            }
+        }
+    }
+
+    for (int y = 0; y < height; y++) {
+        memcpy(plane + (size_t)y * stride, output + (size_t)y * width, (size_t)width);
+    }
+    free(output);
+    free(columns);
+    return 0;
+}
+
+int histeqSlidingAHE(unsigned char *data, int width, int height, int components, int radius) {
+    if (components == 1) {
+        return histeqSlidingAHEPlane(data, width, height, (size_t)width, radius);
+    }
+
+    // RGB goes through a luma plane, and like histeqEqualize() the result is
+    // written to all three channels
+    size_t pixels = (size_t)width * height;
+    unsigned char *gray = (unsigned char *)malloc(pixels);
+    if (gray == NULL) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+    histeqLumaRow(data, gray, pixels);
+    int status = histeqSlidingAHEPlane(gray, width, height, (size_t)width, radius);
+    if (status == 0) {
+        for (size_t i = 0; i < pixels; i++) {
+            data[i * 3] = data[i * 3 + 1] = data[i * 3 + 2] = gray[i];
+        }
+    }
+    free(gray);
+    return status;
+}
@@ -0,0 +1,313 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include <pthread.h>
+#include "histeq_internal.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HISTEQ_X86 1
+#endif
+
+// Interpolation weights are fixed point with 8 fraction bits. The vertical
+// blend of two tile LUTs is halved to 15 bits (at most 255 * 128), so a
+// horizontal pair of them and a pair of weights fit the signed 16-bit lanes
+// of pmaddwd.
+#define WEIGHT_BITS 8
+#define WEIGHT_ONE (1 << WEIGHT_BITS)
+#define BLEND_SHIFT (2 * WEIGHT_BITS - 1)
+
+// Builds the pair table of one column segment for the current row:
+// pairs[v] holds the vertically blended value of the left tile column in its
+// low half and of the right one in its high half. `weight` is the Q8 weight
+// of the lower tile row.
+typedef void (*PairTableKernel)(unsigned int *pairs, const unsigned char *upperLeft, const unsigned char *lowerLeft,
+                                const unsigned char *upperRight, const unsigned char *lowerRight, int weight);
+
+// Maps a run of pixels through a pair table. colWeights[x] holds the Q8
+// weights of the left and the right tile, low and high half.
+typedef void (*BlendKernel)(unsigned char *row, size_t count, const unsigned int *pairs, const unsigned int *colWeights);
+
+static void pairTableScalar(unsigned int *pairs, const unsigned char *upperLeft, const unsigned char *lowerLeft,
+                            const unsigned char *upperRight, const unsigned char *lowerRight, int weight) {
+    for (int v = 0; v < HISTEQ_BINS; v++) {
+        unsigned int left = (upperLeft[v] * (WEIGHT_ONE - weight) + lowerLeft[v] * weight + 1) >> 1;
+        unsigned int right = (upperRight[v] * (WEIGHT_ONE - weight) + lowerRight[v] * weight + 1) >> 1;
+        pairs[v] = left | (right << 16);
+    }
+}
+
+static void blendScalar(unsigned char *row, size_t count, const unsigned int *pairs, const unsigned int *colWeights) {
+    for (size_t x = 0; x < count; x++) {
+        unsigned int pair = pairs[row[x]];
+        unsigned int sum = (pair & 0xffff) * (colWeights[x] & 0xffff) + (pair >> 16) * (colWeights[x] >> 16);
+        row[x] = (unsigned char)((sum + (1 << (BLEND_SHIFT - 1))) >> BLEND_SHIFT);
+    }
+}
+
+#ifdef HISTEQ_X86
+// Sixteen entries of both columns per step in 16-bit lanes, interleaved
+// into pairs with unpack; the unpacks work per 128-bit lane, so the halves
+// are put back in order before storing
+__attribute__((target("avx2")))
+static inline __m256i verticalBlendAVX2(const unsigned char *upper, const unsigned char *lower, __m256i upperWeight, __m256i lowerWeight) {
+    __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)upper));
+    __m256i b = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)lower));
+    __m256i sum = _mm256_add_epi16(_mm256_mullo_epi16(a, upperWeight), _mm256_mullo_epi16(b, lowerWeight));
+    return _mm256_avg_epu16(sum, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static void pairTableAVX2(unsigned int *pairs, const unsigned char *upperLeft, const unsigned char *lowerLeft,
+                          const unsigned char *upperRight, const unsigned char *lowerRight, int weight) {
+    const __m256i upperWeight = _mm256_set1_epi16((short)(WEIGHT_ONE - weight));
+    const __m256i lowerWeight = _mm256_set1_epi16((short)weight);
+    for (int v = 0; v < HISTEQ_BINS; v += 16) {
+        __m256i left = verticalBlendAVX2(upperLeft + v, lowerLeft + v, upperWeight, lowerWeight);
+        __m256i right = verticalBlendAVX2(upperRight + v, lowerRight + v, upperWeight, lowerWeight);
+        __m256i low = _mm256_unpacklo_epi16(left, right);
+        __m256i high = _mm256_unpackhi_epi16(left, right);
+        _mm256_storeu_si256((__m256i *)(pairs + v), _mm256_permute2x128_si256(low, high, 0x20));
+        _mm256_storeu_si256((__m256i *)(pairs + v + 8), _mm256_permute2x128_si256(low, high, 0x31));
+    }
+}
+
+// Eight pixels per step: one gather fetches both tile values of each pixel,
+// and pmaddwd multiplies them by their weights and adds the products
+__attribute__((target("avx2")))
+static void blendAVX2(unsigned char *row, size_t count, const unsigned int *pairs, const unsigned int *colWeights) {
+    const __m256i rounding = _mm256_set1_epi32(1 << (BLEND_SHIFT - 1));
+
+    size_t x = 0;
+    for (; x + 8 <= count; x += 8) {
+        __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(row + x)));
+        __m256i pair = _mm256_i32gather_epi32((const int *)pairs, v, 4);
+        __m256i sum = _mm256_madd_epi16(pair, _mm256_loadu_si256((const __m256i *)(colWeights + x)));
+        sum = _mm256_srli_epi32(_mm256_add_epi32(sum, rounding), BLEND_SHIFT);
+        __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        _mm_storel_epi64((__m128i *)(row + x), _mm_packus_epi16(words, words));
+    }
+    blendScalar(row + x, count - x, pairs, colWeights + x);
+}
+#endif
+
+static BlendKernel blendKernel = blendScalar;
+static PairTableKernel pairTableKernel = pairTableScalar;
+static pthread_once_t kernelsResolved = PTHREAD_ONCE_INIT;
+
+static void resolveCLAHEKernels(void) {
+#ifdef HISTEQ_X86
+    if (histeqCPUHasAVX2()) {
+        blendKernel = blendAVX2;
+        pairTableKernel = pairTableAVX2;
+    }
+#endif
+}
+
+// Clips a tile histogram at `limit` and spreads the excess evenly over all
+// bins; what does not divide evenly goes to bins spaced across the range
+static void clipHistogram(int histogram[HISTEQ_BINS], int limit) {
+    long long excess = 0;
+    for (int i = 0; i < HISTEQ_BINS; i++) {
+        if (histogram[i] > limit) {
+            excess += histogram[i] - limit;
+            histogram[i] = limit;
+        }
+    }
+
+    int bonus = (int)(excess / HISTEQ_BINS);
+    int residual = (int)(excess % HISTEQ_BINS);
+    for (int i = 0; i < HISTEQ_BINS; i++) {
+        histogram[i] += bonus;
+    }
+    if (residual > 0) {
+        int step = HISTEQ_BINS / residual;
+        for (int i = 0; i < HISTEQ_BINS && residual > 0; i += step, residual--) {
+            histogram[i]++;
+        }
+    }
+}
+
+// Tile `t` of `tiles` covers [t * size / tiles, (t + 1) * size / tiles).
+// Centres are kept doubled, start + end - 1, so they stay integral.
+static int tileCentre2(int size, int tiles, int t) {
+    return (int)((long long)t * size / tiles + (long long)(t + 1) * size / tiles - 1);
+}
+
+// For every position along an axis: how many tile centres lie at or before
+// it, and the Q8 weight of the next tile. Between centres t and t + 1 that
+// count is t + 1 and the position blends those two tiles; before the first
+// centre and after the last one it uses a single tile with weight 0.
+static void axisWeights(int size, int tiles, int *span, int *weight) {
+    int passed = 0;
+    for (int p = 0; p < size; p++) {
+        while (passed < tiles && 2 * p >= tileCentre2(size, tiles, passed)) {
+            passed++;
+        }
+        span[p] = passed;
+        weight[p] = 0;
+        if (passed > 0 && passed < tiles) {
+            int c0 = tileCentre2(size, tiles, passed - 1);
+            int c1 = tileCentre2(size, tiles, passed);
+            weight[p] = (int)(((long long)(2 * p - c0) * WEIGHT_ONE + (c1 - c0) / 2) / (c1 - c0));
+        }
+    }
+}
+
+int histeqCLAHEPlane(unsigned char *plane, int width, int height, size_t stride, const HistEqCLAHEParams *params) {
+    int tilesX = params->tilesX;
+    int tilesY = params->tilesY;
+    if (tilesX < 1 || tilesY < 1 || tilesX > HISTEQ_CLAHE_MAX_TILES || tilesY > HISTEQ_CLAHE_MAX_TILES) {
+        fprintf(stderr, "CLAHE tile grid must be between 1x1 and %dx%d\n", HISTEQ_CLAHE_MAX_TILES, HISTEQ_CLAHE_MAX_TILES);
+        return -1;
+    }
+    if (width < 1 || height < 1) {
+        return 0;
+    }
+    // Every tile needs at least one pixel
+    if (tilesX > width) {
+        tilesX = width;
+    }
+    if (tilesY > height) {
+        tilesY = height;
+    }
+
+    int tileCount = tilesX * tilesY;
+    int threads = omp_get_max_threads();
+    unsigned char *luts = (unsigned char *)malloc((size_t)tileCount * HISTEQ_BINS);
+    int *colSpan = (int *)malloc((size_t)width * sizeof(int));
+    unsigned int *colWeights = (unsigned int *)malloc((size_t)width * sizeof(unsigned int));
+    int *rowSpan = (int *)malloc((size_t)height * sizeof(int));
+    int *rowWeight = (int *)malloc((size_t)height * sizeof(int));
+    unsigned int *pairTables = (unsigned int *)malloc((size_t)threads * (tilesX + 1) * HISTEQ_BINS * sizeof(unsigned int));
+    if (luts == NULL || colSpan == NULL || colWeights == NULL || rowSpan == NULL || rowWeight == NULL || pairTables == NULL) {
+        perror("Memory allocation failed");
+        free(luts);
+        free(colSpan);
+        free(colWeights);
+        free(rowSpan);
+        free(rowWeight);
+        free(pairTables);
+        return -1;
+    }
+
+    // One LUT per tile, from its clipped histogram. Tiles are independent, so
+    // they are shared out dynamically; edge tiles can be smaller.
+    #pragma omp parallel for schedule(dynamic)
+    for (int t = 0; t < tileCount; t++) {
+        int tx = t % tilesX, ty = t / tilesX;
+        int x0 = (int)((long long)tx * width / tilesX), x1 = (int)((long long)(tx + 1) * width / tilesX);
+        int y0 = (int)((long long)ty * height / tilesY), y1 = (int)((long long)(ty + 1) * height / tilesY);
+        long long area = (long long)(x1 - x0) * (y1 - y0);
+
+        int histogram[HISTEQ_BINS];
+        memset(histogram, 0, sizeof(histogram));
+        for (int y = y0; y < y1; y++) {
+            histeqHistogramRow(plane + (size_t)y * stride + x0, (size_t)(x1 - x0), histogram);
+        }
+        if (params->clipLimit > 0) {
+            int limit = (int)(params->clipLimit * area / HISTEQ_BINS);
+            clipHistogram(histogram, limit > 0 ? limit : 1);
+        }
+        histeqBuildLUT(histogram, area, luts + (size_t)t * HISTEQ_BINS);
+    }
+
+    axisWeights(width, tilesX, colSpan, (int *)colWeights);
+    axisWeights(height, tilesY, rowSpan, rowWeight);
+    for (int x = 0; x < width; x++) {
+        colWeights[x] = (WEIGHT_ONE - colWeights[x]) | (colWeights[x] << 16);
+    }
+
+    // Columns between the same two tile centres form a segment that blends
+    // the same pair of tile LUTs
+    int segmentStart[HISTEQ_CLAHE_MAX_TILES + 2];
+    int segments = 0;
+    for (int x = 0; x < width; x++) {
+        if (x == 0 || colSpan[x] != colSpan[x - 1]) {
+            segmentStart[segments++] = x;
+        }
+    }
+    segmentStart[segments] = width;
+
+    pthread_once(&kernelsResolved, resolveCLAHEKernels);
+    BlendKernel blend = blendKernel;
+    PairTableKernel pairTable = pairTableKernel;
+
+    // Each row first blends its two tile rows vertically into a pair table
+    // per segment, then every pixel blends its pair horizontally
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < height; y++) {
+        unsigned int *pairs = pairTables + (size_t)omp_get_thread_num() * (tilesX + 1) * HISTEQ_BINS;
+        const unsigned char *upper = luts + (size_t)((rowSpan[y] > 0) ? rowSpan[y] - 1 : 0) * tilesX * HISTEQ_BINS;
+        const unsigned char *lower = luts + (size_t)((rowSpan[y] < tilesY) ? rowSpan[y] : tilesY - 1) * tilesX * HISTEQ_BINS;
+        unsigned char *row = plane + (size_t)y * stride;
+
+        for (int s = 0; s < segments; s++) {
+            int x0 = segmentStart[s];
+            size_t left = (size_t)((colSpan[x0] > 0) ? colSpan[x0] - 1 : 0) * HISTEQ_BINS;
+            size_t right = (size_t)((colSpan[x0] < tilesX) ? colSpan[x0] : tilesX - 1) * HISTEQ_BINS;
+            unsigned int *segmentPairs = pairs + (size_t)s * HISTEQ_BINS;
+            pairTable(segmentPairs, upper + left, lower + left, upper + right, lower + right, rowWeight[y]);
+            blend(row + x0, (size_t)(segmentStart[s + 1] - x0), segmentPairs, colWeights + x0);
+        }
+    }
+
+    free(luts);
+    free(colSpan);
+    free(colWeights);
+    free(rowSpan);
+    free(rowWeight);
+    free(pairTables);
+    return 0;
+}
+
+int histeqCLAHE(unsigned char *data, int width, int height, int components, const HistEqCLAHEParams *params) {
+    if (components == 1) {
+        return histeqCLAHEPlane(data, width, height, (size_t)width, params);
+    }
+
+    // RGB goes through a luma plane, and like histeqEqualize() the result is
+    // written to all three channels
+    size_t pixels = (size_t)width * height;
+    unsigned char *gray = (unsigned char *)malloc(pixels);
+    if (gray == NULL) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+    histeqLumaRow(data, gray, pixels);
+    int status = histeqCLAHEPlane(gray, width, height, (size_t)width, params);
+    if (status == 0) {
+        for (size_t i = 0; i < pixels; i++) {
+            data[i * 3] = data[i * 3 + 1] = data[i * 3 + 2] = gray[i];
+        }
+    }
+    free(gray);
+    return status;
+}
+
+int histeqCLAHEPlanar(HistEqPlanarImage *image, const HistEqCLAHEParams *params) {
+    unsigned char *luma = image->planes[0];
+    size_t stride = (size_t)image->planeWidth[0];
+    int width, height;
+    if (histeqPlanarLumaSize(image, &width, &height) != 0) {
+        return -1;
+    }
+    if (width < 1 || height < 1) {
+        return 0;
+    }
+    if (histeqCLAHEPlane(luma, width, height, stride, params) != 0) {
+        return -1;
+    }
+
+    // Tiles only cover the visible part; the block padding repeats its edge,
+    // as the encoder itself would pad
+    for (int y = 0; y < image->planeHeight[0]; y++) {
+        unsigned char *row = luma + (size_t)y * stride;
+        if (y >= height) {
+            memcpy(row, luma + (size_t)(height - 1) * stride, (size_t)width);
+        }
+        memset(row + width, row[width - 1], stride - width);
+    }
+    return 0;
+}
@@ -0,0 +1,535 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <omp.h>
+#include <pthread.h>
+#include "histeq_internal.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HISTEQ_X86 1
+#endif
+
+// Colour-preserving modes. Each block of interleaved RGB is split into three
+// planes, the mode's key (max, luma or Lab lightness) is computed from the
+// planes, and after the LUT is built a second pass maps the planes and merges
+// them back. The key plane is kept between the passes. The AVX2 kernels use
+// the same integer or single-precision operations in the same order as the
+// scalar ones, and no FMA, so both give identical output.
+
+// Pixels per block; the stack planes of a block stay in L1
+#define COLOUR_BLOCK 2048
+
+static const char *const colourModeNames[HISTEQ_COLOUR_COUNT] = {"gray", "rgb", "hsv", "lab", "ycbcr"};
+
+// CIE Lab from sRGB (D65). X and Z are divided by the white point here, so the
+// forward transform gives X/Xn, Y/Yn and Z/Zn directly, and the inverse takes them.
+#define LAB_XN 0.95047f
+#define LAB_ZN 1.08883f
+
+static const float labForward[3][3] = {
+    {0.4124564f / LAB_XN, 0.3575761f / LAB_XN, 0.1804375f / LAB_XN},
+    {0.2126729f, 0.7151522f, 0.0721750f},
+    {0.0193339f / LAB_ZN, 0.1191920f / LAB_ZN, 0.9503041f / LAB_ZN}
+};
+
+static const float labInverse[3][3] = {
+    {3.2404542f * LAB_XN, -1.5371385f, -0.4985314f * LAB_ZN},
+    {-0.9692660f * LAB_XN, 1.8760108f, 0.0415560f * LAB_ZN},
+    {0.0556434f * LAB_XN, -0.2040259f, 1.0572252f * LAB_ZN}
+};
+
+// f(t) is the cube root above (6/29)^3 and a line of slope 841/108 through
+// 4/29 below it
+#define LAB_EPSILON (216.0f / 24389.0f)
+#define LAB_DELTA (6.0f / 29.0f)
+#define LAB_SLOPE (841.0f / 108.0f)
+#define LAB_OFFSET (4.0f / 29.0f)
+
+// sRGB decoding and encoding tables, built once. The encoding table is padded
+// so a 32-bit gather at the last entry stays inside it.
+static float srgbToLinear[HISTEQ_BINS];
+static unsigned char linearToSRGB[HISTEQ_SRGB_STEPS + 4];
+static pthread_once_t srgbTablesOnce = PTHREAD_ONCE_INIT;
+
+// Per-image state of the apply pass
+typedef struct {
+    HistEqColourMode mode;
+    unsigned char lut[3][HISTEQ_BINS];          // one per channel in RGB mode
+    unsigned int scale[HISTEQ_BINS];            // HSV: lut[v] / v in 16.16
+    unsigned int bias[HISTEQ_BINS];
+    float deltaF[HISTEQ_BINS];                  // Lab: change of f(Y) per L bin
+} ColourMapping;
+
+typedef void (*MaxKernel)(const unsigned char *r, const unsigned char *g, const unsigned char *b, unsigned char *v, size_t count);
+typedef void (*ScaleKernel)(unsigned char *r, unsigned char *g, unsigned char *b, const unsigned char *v, size_t count,
+                            const unsigned int scale[HISTEQ_BINS], const unsigned int bias[HISTEQ_BINS]);
+typedef void (*ShiftKernel)(unsigned char *r, unsigned char *g, unsigned char *b, const unsigned char *before,
+                            const unsigned char *after, size_t count);
+typedef void (*LightnessKernel)(const unsigned char *r, const unsigned char *g, const unsigned char *b, unsigned char *bins,
+                                size_t count);
+typedef void (*LabApplyKernel)(unsigned char *r, unsigned char *g, unsigned char *b, const unsigned char *bins, size_t count,
+                               const float deltaF[HISTEQ_BINS]);
+
+typedef struct {
+    MaxKernel max;
+    ScaleKernel scale;
+    ShiftKernel shift;
+    LightnessKernel lightness;
+    LabApplyKernel labApply;
+} ColourKernels;
+
+static void buildSRGBTables(void) {
+    for (int i = 0; i < HISTEQ_BINS; i++) {
+        float c = i / 255.0f;
+        srgbToLinear[i] = (c <= 0.04045f) ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+    for (int i = 0; i <= HISTEQ_SRGB_STEPS; i++) {
+        float c = (float)i / HISTEQ_SRGB_STEPS;
+        float encoded = (c <= 0.0031308f) ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+        int value = (int)(encoded * 255.0f + 0.5f);
+        linearToSRGB[i] = (unsigned char)(value < 0 ? 0 : value > 255 ? 255 : value);
+    }
+    memset(linearToSRGB + HISTEQ_SRGB_STEPS + 1, 255, sizeof(linearToSRGB) - HISTEQ_SRGB_STEPS - 1);
+}
+
+const unsigned char *histeqLinearToSRGB(void) {
+    pthread_once(&srgbTablesOnce, buildSRGBTables);
+    return linearToSRGB;
+}
+
+// Cube root from the exponent-thirding bit trick and two Newton steps, within
+// 2e-6 of cbrtf() over the range f() uses it for
+static inline float cubeRoot(float x) {
+    int bits;
+    memcpy(&bits, &x, sizeof(bits));
+    bits = (int)((float)bits * (1.0f / 3.0f)) + 709921077;
+    float y;
+    memcpy(&y, &bits, sizeof(y));
+    for (int i = 0; i < 2; i++) {
+        y = (2.0f * y + x / (y * y)) * (1.0f / 3.0f);
+    }
+    return y;
+}
+
+static inline float labF(float t) {
+    return (t > LAB_EPSILON) ? cubeRoot(t) : t * LAB_SLOPE + LAB_OFFSET;
+}
+
+static inline float labFInverse(float f) {
+    return (f > LAB_DELTA) ? f * f * f : (f - LAB_OFFSET) * (1.0f / LAB_SLOPE);
+}
+
+static inline unsigned char encodeSRGB(float c) {
+    c = (c > 0.0f) ? c : 0.0f;
+    c = (c < 1.0f) ? c : 1.0f;
+    return linearToSRGB[(int)(c * HISTEQ_SRGB_STEPS + 0.5f)];
+}
+
+// L * 2.55 rounded, with L = 116 f(Y) - 16
+static inline unsigned char lightnessBin(float fY) {
+    int bin = (int)((116.0f * fY - 16.0f) * 2.55f + 0.5f);
+    return (unsigned char)(bin < 0 ? 0 : bin > 255 ? 255 : bin);
+}
+
+static void maxScalar(const unsigned char *r, const unsigned char *g, const unsigned char *b, unsigned char *v, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        unsigned char m = (r[i] > g[i]) ? r[i] : g[i];
+        v[i] = (m > b[i]) ? m : b[i];
+    }
+}
+
+// Every channel is scaled by lut[v] / v, which keeps hue and saturation. The
+// scale is rounded so the largest channel lands exactly on lut[v] and none
+// can exceed it. Black has no hue; it becomes gray lut[0] through the bias.
+static void scaleScalar(unsigned char *r, unsigned char *g, unsigned char *b, const unsigned char *v, size_t count,
+                        const unsigned int scale[HISTEQ_BINS], const unsigned int bias[HISTEQ_BINS]) {
+    for (size_t i = 0; i < count; i++) {
+        unsigned int s = scale[v[i]];
+        unsigned int offset = bias[v[i]];
+        r[i] = (unsigned char)((r[i] * s + offset) >> 16);
+        g[i] = (unsigned char)((g[i] * s + offset) >> 16);
+        b[i] = (unsigned char)((b[i] * s + offset) >> 16);
+    }
+}
+
+// Luma weights sum to one, so adding the change of Y to all three channels
+// leaves Cb and Cr as they were, up to saturation at 0 and 255
+static void shiftScalar(unsigned char *r, unsigned char *g, unsigned char *b, const unsigned char *before,
+                        const unsigned char *after, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int delta = after[i] - before[i];
+        int red = r[i] + delta, green = g[i] + delta, blue = b[i] + delta;
+        r[i] = (unsigned char)(red < 0 ? 0 : red > 255 ? 255 : red);
+        g[i] = (unsigned char)(green < 0 ? 0 : green > 255 ? 255 : green);
+        b[i] = (unsigned char)(blue < 0 ? 0 : blue > 255 ? 255 : blue);
+    }
+}
+
+static void lightnessScalar(const unsigned char *r, const unsigned char *g, const unsigned char *b, unsigned char *bins,
+                            size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        float red = srgbToLinear[r[i]], green = srgbToLinear[g[i]], blue = srgbToLinear[b[i]];
+        float y = labForward[1][0] * red + labForward[1][1] * green + labForward[1][2] * blue;
+        bins[i] = lightnessBin(labF(y));
+    }
+}
+
+// L moves by the LUT's change of its bin, a* and b* stay: in f() space that
+// is the same offset on all three of f(X), f(Y) and f(Z)
+static void labApplyScalar(unsigned char *r, unsigned char *g, unsigned char *b, const unsigned char *bins, size_t count,
+                           const float deltaF[HISTEQ_BINS]) {
+    for (size_t i = 0; i < count; i++) {
+        float red = srgbToLinear[r[i]], green = srgbToLinear[g[i]], blue = srgbToLinear[b[i]];
+        float delta = deltaF[bins[i]];
+        float f[3];
+        for (int k = 0; k < 3; k++) {
+            f[k] = labF(labForward[k][0] * red + labForward[k][1] * green + labForward[k][2] * blue) + delta;
+        }
+        float x = labFInverse(f[0]), y = labFInverse(f[1]), z = labFInverse(f[2]);
+        r[i] = encodeSRGB(labInverse[0][0] * x + labInverse[0][1] * y + labInverse[0][2] * z);
+        g[i] = encodeSRGB(labInverse[1][0] * x + labInverse[1][1] * y + labInverse[1][2] * z);
+        b[i] = encodeSRGB(labInverse[2][0] * x + labInverse[2][1] * y + labInverse[2][2] * z);
+    }
+}
+
+static const ColourKernels scalarKernels = {maxScalar, scaleScalar, shiftScalar, lightnessScalar, labApplyScalar};
+
+#ifdef HISTEQ_X86
+__attribute__((target("avx2")))
+static void maxAVX2(const unsigned char *r, const unsigned char *g, const unsigned char *b, unsigned char *v, size_t count) {
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i m = _mm256_max_epu8(_mm256_loadu_si256((const __m256i *)(r + i)), _mm256_loadu_si256((const __m256i *)(g + i)));
+        m = _mm256_max_epu8(m, _mm256_loadu_si256((const __m256i *)(b + i)));
+        _mm256_storeu_si256((__m256i *)(v + i), m);
+    }
+    maxScalar(r + i, g + i, b + i, v + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m128i scaleChannel(const unsigned char *channel, __m256i s, __m256i offset) {
+    __m256i c = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)channel));
+    c = _mm256_srli_epi32(_mm256_add_epi32(_mm256_mullo_epi32(c, s), offset), 16);
+    __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(c), _mm256_extracti128_si256(c, 1));
+    return _mm_packus_epi16(words, words);
+}
+
+// 8 pixels per step, one gather each for scale and bias
+__attribute__((target("avx2")))
+static void scaleAVX2(unsigned char *r, unsigned char *g, unsigned char *b, const unsigned char *v, size_t count,
+                      const unsigned int scale[HISTEQ_BINS], const unsigned int bias[HISTEQ_BINS]) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i index = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(v + i)));
+        __m256i s = _mm256_i32gather_epi32((const int *)scale, index, 4);
+        __m256i offset = _mm256_i32gather_epi32((const int *)bias, index, 4);
+        _mm_storel_epi64((__m128i *)(r + i), scaleChannel(r + i, s, offset));
+        _mm_storel_epi64((__m128i *)(g + i), scaleChannel(g + i, s, offset));
+        _mm_storel_epi64((__m128i *)(b + i), scaleChannel(b + i, s, offset));
+    }
+    scaleScalar(r + i, g + i, b + i, v + i, count - i, scale, bias);
+}
+
+// The change of Y split into its positive and negative parts, each applied
+// with a saturating byte add or subtract
+__attribute__((target("avx2")))
+static void shiftAVX2(unsigned char *r, unsigned char *g, unsigned char *b, const unsigned char *before,
+                      const unsigned char *after, size_t count) {
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i previous = _mm256_loadu_si256((const __m256i *)(before + i));
+        __m256i current = _mm256_loadu_si256((const __m256i *)(after + i));
+        __m256i up = _mm256_subs_epu8(current, previous);
+        __m256i down = _mm256_subs_epu8(previous, current);
+        unsigned char *planes[3] = {r + i, g + i, b + i};
+        for (int k = 0; k < 3; k++) {
+            __m256i c = _mm256_loadu_si256((const __m256i *)planes[k]);
+            _mm256_storeu_si256((__m256i *)planes[k], _mm256_subs_epu8(_mm256_adds_epu8(c, up), down));
+        }
+    }
+    shiftScalar(r + i, g + i, b + i, before + i, after + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 cubeRootAVX2(__m256 x) {
+    __m256i bits = _mm256_castps_si256(x);
+    bits = _mm256_add_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(bits), _mm256_set1_ps(1.0f / 3.0f))),
+                            _mm256_set1_epi32(709921077));
+    __m256 y = _mm256_castsi256_ps(bits);
+    for (int i = 0; i < 2; i++) {
+        y = _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(2.0f), y), _mm256_div_ps(x, _mm256_mul_ps(y, y))),
+                          _mm256_set1_ps(1.0f / 3.0f));
+    }
+    return y;
+}
+
+__attribute__((target("avx2")))
+static inline __m256 labFAVX2(__m256 t) {
+    __m256 linear = _mm256_add_ps(_mm256_mul_ps(t, _mm256_set1_ps(LAB_SLOPE)), _mm256_set1_ps(LAB_OFFSET));
+    return _mm256_blendv_ps(linear, cubeRootAVX2(t), _mm256_cmp_ps(t, _mm256_set1_ps(LAB_EPSILON), _CMP_GT_OQ));
+}
+
+__attribute__((target("avx2")))
+static inline __m256 labFInverseAVX2(__m256 f) {
+    __m256 cube = _mm256_mul_ps(_mm256_mul_ps(f, f), f);
+    __m256 linear = _mm256_mul_ps(_mm256_sub_ps(f, _mm256_set1_ps(LAB_OFFSET)), _mm256_set1_ps(1.0f / LAB_SLOPE));
+    return _mm256_blendv_ps(linear, cube, _mm256_cmp_ps(f, _mm256_set1_ps(LAB_DELTA), _CMP_GT_OQ));
+}
+
+__attribute__((target("avx2")))
+static inline __m256 dotAVX2(const float row[3], __m256 a, __m256 b, __m256 c) {
+    return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(row[0]), a), _mm256_mul_ps(_mm256_set1_ps(row[1]), b)),
+                         _mm256_mul_ps(_mm256_set1_ps(row[2]), c));
+}
+
+__attribute__((target("avx2")))
+static inline __m256 decodeAVX2(const unsigned char *channel) {
+    return _mm256_i32gather_ps(srgbToLinear, _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)channel)), 4);
+}
+
+// Eight bytes from the padded encoding table
+__attribute__((target("avx2")))
+static inline void encodeAVX2(unsigned char *channel, __m256 c) {
+    c = _mm256_min_ps(_mm256_max_ps(c, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+    __m256i index = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(c, _mm256_set1_ps((float)HISTEQ_SRGB_STEPS)), _mm256_set1_ps(0.5f)));
+    __m256i bytes = _mm256_and_si256(_mm256_i32gather_epi32((const int *)linearToSRGB, index, 1), _mm256_set1_epi32(0xFF));
+    __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(bytes), _mm256_extracti128_si256(bytes, 1));
+    _mm_storel_epi64((__m128i *)channel, _mm_packus_epi16(words, words));
+}
+
+__attribute__((target("avx2")))
+static inline void storeBinsAVX2(unsigned char *bins, __m256 fY) {
+    __m256 scaled = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_set1_ps(116.0f), fY), _mm256_set1_ps(16.0f)),
+                                                _mm256_set1_ps(2.55f)), _mm256_set1_ps(0.5f));
+    // Truncation toward zero as in the scalar cast, then the clamp
+    __m256i bin = _mm256_max_epi32(_mm256_cvttps_epi32(scaled), _mm256_setzero_si256());
+    __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(bin), _mm256_extracti128_si256(bin, 1));
+    _mm_storel_epi64((__m128i *)bins, _mm_packus_epi16(words, words));
+}
+
+__attribute__((target("avx2")))
+static void lightnessAVX2(const unsigned char *r, const unsigned char *g, const unsigned char *b, unsigned char *bins,
+                          size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 y = dotAVX2(labForward[1], decodeAVX2(r + i), decodeAVX2(g + i), decodeAVX2(b + i));
+        storeBinsAVX2(bins + i, labFAVX2(y));
+    }
+    lightnessScalar(r + i, g + i, b + i, bins + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void labApplyAVX2(unsigned char *r, unsigned char *g, unsigned char *b, const unsigned char *bins, size_t count,
+                         const float deltaF[HISTEQ_BINS]) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 red = decodeAVX2(r + i), green = decodeAVX2(g + i), blue = decodeAVX2(b + i);
+        __m256 delta = _mm256_i32gather_ps(deltaF, _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(bins + i))), 4);
+        __m256 x = labFInverseAVX2(_mm256_add_ps(labFAVX2(dotAVX2(labForward[0], red, green, blue)), delta));
+        __m256 y = labFInverseAVX2(_mm256_add_ps(labFAVX2(dotAVX2(labForward[1], red, green, blue)), delta));
+        __m256 z = labFInverseAVX2(_mm256_add_ps(labFAVX2(dotAVX2(labForward[2], red, green, blue)), delta));
+        encodeAVX2(r + i, dotAVX2(labInverse[0], x, y, z));
+        encodeAVX2(g + i, dotAVX2(labInverse[1], x, y, z));
+        encodeAVX2(b + i, dotAVX2(labInverse[2], x, y, z));
+    }
+    labApplyScalar(r + i, g + i, b + i, bins + i, count - i, deltaF);
+}
+
+static const ColourKernels avx2Kernels = {maxAVX2, scaleAVX2, shiftAVX2, lightnessAVX2, labApplyAVX2};
+#endif
+
+static const ColourKernels *colourKernels = &scalarKernels;
+static pthread_once_t kernelsResolved = PTHREAD_ONCE_INIT;
+
+static void resolveColourKernels(void) {
+#ifdef HISTEQ_X86
+    if (histeqCPUHasAVX2()) {
+        colourKernels = &avx2Kernels;
+    }
+#endif
+}
+
+const char *histeqColourModeName(HistEqColourMode mode) {
+    if (mode < 0 || mode >= HISTEQ_COLOUR_COUNT) {
+        return NULL;
+    }
+    return colourModeNames[mode];
+}
+
+int histeqFindColourMode(const char *name, HistEqColourMode *mode) {
+    for (int i = 0; i < HISTEQ_COLOUR_COUNT; i++) {
+        if (strcmp(colourModeNames[i], name) == 0) {
+            *mode = (HistEqColourMode)i;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// First pass over a slice: the key of every pixel into `key`, binned into
+// histograms[0], or in RGB mode each channel into its own histogram
+static void keySlice(const ColourKernels *kernels, HistEqColourMode mode, const unsigned char *rgb, unsigned char *key,
+                     size_t pixels, int histograms[3][HISTEQ_BINS]) {
+    unsigned char r[COLOUR_BLOCK], g[COLOUR_BLOCK], b[COLOUR_BLOCK];
+
+    for (size_t i = 0; i < pixels; i += COLOUR_BLOCK) {
+        size_t count = (pixels - i < COLOUR_BLOCK) ? pixels - i : COLOUR_BLOCK;
+        if (mode == HISTEQ_COLOUR_YCBCR) {
+            histeqLumaRow(rgb + i * 3, key + i, count);
+            histeqHistogramRow(key + i, count, histograms[0]);
+            continue;
+        }
+
+        histeqSplitRGBRow(rgb + i * 3, r, g, b, count);
+        if (mode == HISTEQ_COLOUR_RGB) {
+            histeqHistogramRow(r, count, histograms[0]);
+            histeqHistogramRow(g, count, histograms[1]);
+            histeqHistogramRow(b, count, histograms[2]);
+            continue;
+        }
+        if (mode == HISTEQ_COLOUR_HSV) {
+            kernels->max(r, g, b, key + i, count);
+        } else {
+            kernels->lightness(r, g, b, key + i, count);
+        }
+        histeqHistogramRow(key + i, count, histograms[0]);
+    }
+}
+
+static void applySlice(const ColourKernels *kernels, const ColourMapping *mapping, unsigned char *rgb, const unsigned char *key,
+                       size_t pixels) {
+    unsigned char r[COLOUR_BLOCK], g[COLOUR_BLOCK], b[COLOUR_BLOCK], mapped[COLOUR_BLOCK];
+
+    for (size_t i = 0; i < pixels; i += COLOUR_BLOCK) {
+        size_t count = (pixels - i < COLOUR_BLOCK) ? pixels - i : COLOUR_BLOCK;
+        histeqSplitRGBRow(rgb + i * 3, r, g, b, count);
+        switch (mapping->mode) {
+            case HISTEQ_COLOUR_RGB:
+                histeqApplyLUTRow(r, count, mapping->lut[0]);
+                histeqApplyLUTRow(g, count, mapping->lut[1]);
+                histeqApplyLUTRow(b, count, mapping->lut[2]);
+                break;
+            case HISTEQ_COLOUR_HSV:
+                kernels->scale(r, g, b, key + i, count, mapping->scale, mapping->bias);
+                break;
+            case HISTEQ_COLOUR_LAB:
+                kernels->labApply(r, g, b, key + i, count, mapping->deltaF);
+                break;
+            default:
+                memcpy(mapped, key + i, count);
+                histeqApplyLUTRow(mapped, count, mapping->lut[0]);
+                kernels->shift(r, g, b, key + i, mapped, count);
+                break;
+        }
+        histeqMergeRGBRow(r, g, b, rgb + i * 3, count);
+    }
+}
+
+static void buildMapping(ColourMapping *mapping) {
+    const unsigned char *lut = mapping->lut[0];
+    if (mapping->mode == HISTEQ_COLOUR_HSV) {
+        for (int v = 1; v < HISTEQ_BINS; v++) {
+            mapping->scale[v] = ((unsigned int)lut[v] * 65536 + v / 2) / v;
+            mapping->bias[v] = 32768;
+        }
+        mapping->scale[0] = 0;
+        mapping->bias[0] = (unsigned int)lut[0] << 16;
+    } else if (mapping->mode == HISTEQ_COLOUR_LAB) {
+        // A bin is 1 / 2.55 of L, and L is 116 f(Y) - 16
+        for (int i = 0; i < HISTEQ_BINS; i++) {
+            mapping->deltaF[i] = (lut[i] - i) / 2.55f / 116.0f;
+        }
+    }
+}
+
+int histeqEqualizeColour(const HistEqBackend *backend, unsigned char *rgb, int width, int height, HistEqColourMode mode,
+                         int histogramBefore[HISTEQ_BINS], int histogramAfter[HISTEQ_BINS]) {
+    if (mode < 0 || mode >= HISTEQ_COLOUR_COUNT) {
+        fprintf(stderr, "Unknown colour mode %d\n", (int)mode);
+        return -1;
+    }
+    if (mode == HISTEQ_COLOUR_GRAY) {
+        histeqEqualize(backend, rgb, width, height, 3, histogramBefore, histogramAfter);
+        return 0;
+    }
+
+    size_t pixels = (size_t)width * height;
+    unsigned char *key = NULL;
+    if (mode != HISTEQ_COLOUR_RGB) {
+        key = (unsigned char *)malloc(pixels > 0 ? pixels : 1);
+        if (key == NULL) {
+            perror("Memory allocation failed");
+            return -1;
+        }
+    }
+
+    pthread_once(&kernelsResolved, resolveColourKernels);
+    const ColourKernels *kernels = colourKernels;
+    if (mode == HISTEQ_COLOUR_LAB) {
+        histeqLinearToSRGB();
+    }
+
+    // Only the OpenMP backend spreads the slices over threads
+    int histograms[3][HISTEQ_BINS];
+    memset(histograms, 0, sizeof(histograms));
+    int parallel = backend == &histeqOpenMPBackend;
+    HistEqPartials partials;
+    if (histeqAllocPartials(&partials, parallel ? omp_get_max_threads() : 1, 3 * HISTEQ_BINS) != 0) {
+        perror("Memory allocation failed");
+        free(key);
+        return -1;
+    }
+
+    #pragma omp parallel if (parallel)
+    {
+        int (*local)[HISTEQ_BINS] = (int (*)[HISTEQ_BINS])histeqPartialRow(&partials);
+        int threads = omp_get_num_threads();
+        int thread = omp_get_thread_num();
+        size_t begin = pixels * thread / threads;
+        size_t end = pixels * (thread + 1) / threads;
+        keySlice(kernels, mode, rgb + begin * 3, key ? key + begin : NULL, end - begin, local);
+        histeqReduceHistograms(&partials, &histograms[0][0]);
+    }
+    histeqFreePartials(&partials);
+
+    ColourMapping mapping;
+    mapping.mode = mode;
+    int channels = (mode == HISTEQ_COLOUR_RGB) ? 3 : 1;
+    for (int c = 0; c < channels; c++) {
+        histeqBuildLUT(histograms[c], (long long)pixels, mapping.lut[c]);
+    }
+    buildMapping(&mapping);
+
+    #pragma omp parallel if (parallel)
+    {
+        int threads = omp_get_num_threads();
+        int thread = omp_get_thread_num();
+        size_t begin = pixels * thread / threads;
+        size_t end = pixels * (thread + 1) / threads;
+        applySlice(kernels, &mapping, rgb + begin * 3, key ? key + begin : NULL, end - begin);
+    }
+    free(key);
+
+    // In RGB mode the histograms are summed over the three channels
+    if (histogramBefore != NULL) {
+        memset(histogramBefore, 0, HISTEQ_BINS * sizeof(int));
+        for (int c = 0; c < channels; c++) {
+            for (int i = 0; i < HISTEQ_BINS; i++) {
+                histogramBefore[i] += histograms[c][i];
+            }
+        }
+    }
+    if (histogramAfter != NULL) {
+        int after[HISTEQ_BINS];
+        memset(histogramAfter, 0, HISTEQ_BINS * sizeof(int));
+        for (int c = 0; c < channels; c++) {
+            histeqHistogramFromLUT(histograms[c], mapping.lut[c], 1, after);
+            for (int i = 0; i < HISTEQ_BINS; i++) {
+                histogramAfter[i] += after[i];
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,212 @@
+#include <string.h>
+#include <pthread.h>
+#include "histeq_internal.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HISTEQ_X86 1
+#endif
+
+// Orthonormal 8-point DCT-II basis: dctBasis[x][u] = C(u) / 2 * cos((2x + 1) u pi / 16)
+// with C(0) = 1 / sqrt(2), C(u) = 1 otherwise. The forward transform of a block
+// is B^T f B and the inverse is B F B^T.
+static const float dctBasis[8][8] = {
+    {0.353553391f, 0.490392640f, 0.461939766f, 0.415734806f, 0.353553391f, 0.277785117f, 0.191341716f, 0.097545161f},
+    {0.353553391f, 0.415734806f, 0.191341716f, -0.097545161f, -0.353553391f, -0.490392640f, -0.461939766f, -0.277785117f},
+    {0.353553391f, 0.277785117f, -0.191341716f, -0.490392640f, -0.353553391f, 0.097545161f, 0.461939766f, 0.415734806f},
+    {0.353553391f, 0.097545161f, -0.461939766f, -0.277785117f, 0.353553391f, 0.415734806f, -0.191341716f, -0.490392640f},
+    {0.353553391f, -0.097545161f, -0.461939766f, 0.277785117f, 0.353553391f, -0.415734806f, -0.191341716f, 0.490392640f},
+    {0.353553391f, -0.277785117f, -0.191341716f, 0.490392640f, -0.353553391f, -0.097545161f, 0.461939766f, -0.415734806f},
+    {0.353553391f, -0.415734806f, 0.191341716f, 0.097545161f, -0.353553391f, 0.490392640f, -0.461939766f, 0.277785117f},
+    {0.353553391f, -0.490392640f, 0.461939766f, -0.415734806f, 0.353553391f, -0.277785117f, 0.191341716f, -0.097545161f},
+};
+
+// The same basis transposed, dctBasisT[u][x], so both passes can be written
+// as 8-wide row updates: acc[0..7] += scalar * row[0..7]
+static const float dctBasisT[8][8] = {
+    {0.353553391f, 0.353553391f, 0.353553391f, 0.353553391f, 0.353553391f, 0.353553391f, 0.353553391f, 0.353553391f},
+    {0.490392640f, 0.415734806f, 0.277785117f, 0.097545161f, -0.097545161f, -0.277785117f, -0.415734806f, -0.490392640f},
+    {0.461939766f, 0.191341716f, -0.191341716f, -0.461939766f, -0.461939766f, -0.191341716f, 0.191341716f, 0.461939766f},
+    {0.415734806f, -0.097545161f, -0.490392640f, -0.277785117f, 0.277785117f, 0.490392640f, 0.097545161f, -0.415734806f},
+    {0.353553391f, -0.353553391f, -0.353553391f, 0.353553391f, 0.353553391f, -0.353553391f, -0.353553391f, 0.353553391f},
+    {0.277785117f, -0.490392640f, 0.097545161f, 0.415734806f, -0.415734806f, -0.097545161f, 0.490392640f, -0.277785117f},
+    {0.191341716f, -0.461939766f, 0.461939766f, -0.191341716f, -0.191341716f, 0.461939766f, -0.461939766f, 0.191341716f},
+    {0.097545161f, -0.277785117f, 0.415734806f, -0.490392640f, 0.490392640f, -0.415734806f, 0.277785117f, -0.097545161f},
+};
+
+typedef void (*IDCTKernel)(const short *coefficients, const unsigned short *quant, unsigned char *pixels, size_t stride);
+typedef void (*FDCTKernel)(const unsigned char *pixels, size_t stride, const unsigned short *quant, short *coefficients);
+
+static void idctScalar(const short *coefficients, const unsigned short *quant, unsigned char *pixels, size_t stride) {
+    float rows[8][8] = {{0}};
+
+    // Row pass: rows[v][x] = sum over u of F[v][u] * basis[x][u]. Quantized
+    // blocks are mostly zeros, so skip those terms.
+    for (int v = 0; v < 8; v++) {
+        for (int u = 0; u < 8; u++) {
+            if (coefficients[v * 8 + u] != 0) {
+                float value = (float)coefficients[v * 8 + u] * quant[v * 8 + u];
+                for (int x = 0; x < 8; x++) {
+                    rows[v][x] += value * dctBasisT[u][x];
+                }
+            }
+        }
+    }
+
+    // Column pass: f[y][x] = sum over v of basis[y][v] * rows[v][x], then undo
+    // the level shift (the extra 0.5 rounds on truncation)
+    for (int y = 0; y < 8; y++) {
+        float sum[8];
+        for (int x = 0; x < 8; x++) {
+            sum[x] = 128.5f;
+        }
+        for (int v = 0; v < 8; v++) {
+            for (int x = 0; x < 8; x++) {
+                sum[x] += dctBasis[y][v] * rows[v][x];
+            }
+        }
+        for (int x = 0; x < 8; x++) {
+            pixels[y * stride + x] = (sum[x] <= 0) ? 0 : (sum[x] >= 255) ? 255 : (unsigned char)sum[x];
+        }
+    }
+}
+
+static void fdctScalar(const unsigned char *pixels, size_t stride, const unsigned short *quant, short *coefficients) {
+    float rows[8][8] = {{0}};
+
+    // Row pass: rows[y][u] = sum over x of (f[y][x] - 128) * basis[x][u]
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            float value = (float)pixels[y * stride + x] - 128;
+            for (int u = 0; u < 8; u++) {
+                rows[y][u] += value * dctBasis[x][u];
+            }
+        }
+    }
+
+    // Column pass: F[v][u] = sum over y of basis[y][v] * rows[y][u], then
+    // quantize to the nearest step
+    for (int v = 0; v < 8; v++) {
+        float sum[8] = {0};
+        for (int y = 0; y < 8; y++) {
+            for (int u = 0; u < 8; u++) {
+                sum[u] += dctBasis[y][v] * rows[y][u];
+            }
+        }
+        for (int u = 0; u < 8; u++) {
+            float level = sum[u] / quant[v * 8 + u];
+            coefficients[v * 8 + u] = (short)((level < 0) ? level - 0.5f : level + 0.5f);
+        }
+    }
+}
+
+#ifdef HISTEQ_X86
+// One ymm register per block row; both passes are 64 broadcast multiply-adds
+__attribute__((target("avx2,fma")))
+static void idctAVX2(const short *coefficients, const unsigned short *quant, unsigned char *pixels, size_t stride) {
+    // Blocks with only a DC term are common in smooth areas and are flat:
+    // every pixel is DC * step / 8 + 128
+    const __m256i notDC = _mm256_setr_epi16(0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    __m256i acTerms = _mm256_and_si256(_mm256_loadu_si256((const __m256i *)coefficients), notDC);
+    acTerms = _mm256_or_si256(acTerms, _mm256_loadu_si256((const __m256i *)(coefficients + 16)));
+    acTerms = _mm256_or_si256(acTerms, _mm256_loadu_si256((const __m256i *)(coefficients + 32)));
+    acTerms = _mm256_or_si256(acTerms, _mm256_loadu_si256((const __m256i *)(coefficients + 48)));
+    if (_mm256_testz_si256(acTerms, acTerms)) {
+        float value = (float)coefficients[0] * quant[0] * 0.125f + 128.5f;
+        unsigned char flat = (value <= 0) ? 0 : (value >= 255) ? 255 : (unsigned char)value;
+        for (int y = 0; y < 8; y++) {
+            memset(pixels + y * stride, flat, 8);
+        }
+        return;
+    }
+
+    __m256 rows[8];
+    for (int v = 0; v < 8; v++) {
+        __m128i coefficientRow = _mm_loadu_si128((const __m128i *)(coefficients + v * 8));
+        rows[v] = _mm256_setzero_ps();
+        if (_mm_testz_si128(coefficientRow, coefficientRow)) {
+            continue;
+        }
+
+        float value[8];
+        __m256 dequantized = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(coefficientRow)),
+                                           _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(quant + v * 8)))));
+        _mm256_storeu_ps(value, dequantized);
+        for (int u = 0; u < 8; u++) {
+            rows[v] = _mm256_fmadd_ps(_mm256_set1_ps(value[u]), _mm256_loadu_ps(dctBasisT[u]), rows[v]);
+        }
+    }
+
+    const __m256 low = _mm256_setzero_ps();
+    const __m256 high = _mm256_set1_ps(255.0f);
+    for (int y = 0; y < 8; y++) {
+        __m256 sum = _mm256_set1_ps(128.5f);
+        for (int v = 0; v < 8; v++) {
+            sum = _mm256_fmadd_ps(_mm256_set1_ps(dctBasis[y][v]), rows[v], sum);
+        }
+        __m256i values = _mm256_cvttps_epi32(_mm256_min_ps(_mm256_max_ps(sum, low), high));
+        __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(values), _mm256_extracti128_si256(values, 1));
+        _mm_storel_epi64((__m128i *)(pixels + y * stride), _mm_packus_epi16(words, words));
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void fdctAVX2(const unsigned char *pixels, size_t stride, const unsigned short *quant, short *coefficients) {
+    __m256 basis[8];
+    for (int x = 0; x < 8; x++) {
+        basis[x] = _mm256_loadu_ps(dctBasis[x]);
+    }
+
+    __m256 rows[8];
+    const __m256 shift = _mm256_set1_ps(128.0f);
+    for (int y = 0; y < 8; y++) {
+        float value[8];
+        __m128i bytes = _mm_loadl_epi64((const __m128i *)(pixels + y * stride));
+        _mm256_storeu_ps(value, _mm256_sub_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(bytes)), shift));
+        rows[y] = _mm256_setzero_ps();
+        for (int x = 0; x < 8; x++) {
+            rows[y] = _mm256_fmadd_ps(_mm256_set1_ps(value[x]), basis[x], rows[y]);
+        }
+    }
+
+    // Round half away from zero, like the scalar version
+    const __m256 signBit = _mm256_set1_ps(-0.0f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    for (int v = 0; v < 8; v++) {
+        __m256 sum = _mm256_setzero_ps();
+        for (int y = 0; y < 8; y++) {
+            sum = _mm256_fmadd_ps(_mm256_set1_ps(dctBasis[y][v]), rows[y], sum);
+        }
+        __m256 steps = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(quant + v * 8))));
+        __m256 level = _mm256_div_ps(sum, steps);
+        level = _mm256_add_ps(level, _mm256_or_ps(half, _mm256_and_ps(level, signBit)));
+        __m256i values = _mm256_cvttps_epi32(level);
+        _mm_storeu_si128((__m128i *)(coefficients + v * 8),
+                         _mm_packs_epi32(_mm256_castsi256_si128(values), _mm256_extracti128_si256(values, 1)));
+    }
+}
+#endif
+
+static IDCTKernel idctKernel = idctScalar;
+static FDCTKernel fdctKernel = fdctScalar;
+static pthread_once_t kernelsResolved = PTHREAD_ONCE_INIT;
+
+// AVX2 with FMA when available; HISTEQ_ISA=scalar forces the scalar code
+static void resolveDCTKernels(void) {
+#ifdef HISTEQ_X86
+    if (histeqCPUHasFMA()) {
+        idctKernel = idctAVX2;
+        fdctKernel = fdctAVX2;
+    }
+#endif
+}
+
+void histeqIDCTBlock(const short coefficients[64], const unsigned short quant[64], unsigned char *pixels, size_t stride) {
+    pthread_once(&kernelsResolved, resolveDCTKernels);
+    idctKernel(coefficients, quant, pixels, stride);
+}
+
+void histeqFDCTBlock(const unsigned char *pixels, size_t stride, const unsigned short quant[64], short coefficients[64]) {
+    pthread_once(&kernelsResolved, resolveDCTKernels);
+    fdctKernel(pixels, stride, quant, coefficients);
+}
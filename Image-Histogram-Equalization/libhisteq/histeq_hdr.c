@@ -0,0 +1,320 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <omp.h>
+#include <pthread.h>
+#include "histeq_internal.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HISTEQ_X86 1
+#endif
+
+// Floating-point (HDR) equalization. The histogram is over log2 of the
+// luminance, between the darkest and brightest pixel, and its CDF maps each
+// bin edge to an output level. Pixels are mapped by linear interpolation
+// between the two edges around them, and their colour is scaled by the ratio
+// of output to input luminance, so hue is kept. Everything runs over tiles of
+// HDR_TILE pixels with a per-thread log-luminance tile, so nothing but the
+// input and the 8-bit output is image-sized. The AVX2 kernels repeat the
+// scalar operations in the same order, without FMA, and match them exactly.
+
+#define HDR_TILE 4096
+
+// Luminance more than this many stops below the brightest pixel shares the
+// lowest bin, so a few near-black pixels cannot stretch the range
+#define HDR_MAX_STOPS 32
+
+// Rec. 709 luminance of linear RGB
+#define HDR_LUMA_R 0.2126f
+#define HDR_LUMA_G 0.7152f
+#define HDR_LUMA_B 0.0722f
+
+// log2(m) = 2 / ln 2 * atanh(t) with t = (m - 1) / (m + 1), as a series in t
+#define HDR_LOG_C1 2.8853900817779268f
+#define HDR_LOG_C3 (HDR_LOG_C1 / 3.0f)
+#define HDR_LOG_C5 (HDR_LOG_C1 / 5.0f)
+#define HDR_LOG_C7 (HDR_LOG_C1 / 7.0f)
+
+typedef struct {
+    float minLog;
+    float scale;                // bins per stop
+    int bins;
+    const float *lut;           // bins + 1 linear output luminances, one per bin edge
+    const unsigned char *encode;
+} HDRMapping;
+
+typedef void (*LogLumaKernel)(const float *rgb, float *logLuma, size_t count);
+typedef void (*ToneMapKernel)(const float *rgb, unsigned char *r, unsigned char *g, unsigned char *b, size_t count,
+                              const HDRMapping *mapping);
+
+static inline float luminance(const float *pixel) {
+    float l = HDR_LUMA_R * pixel[0] + HDR_LUMA_G * pixel[1] + HDR_LUMA_B * pixel[2];
+    // Also maps NaN to FLT_MIN
+    l = (l > FLT_MIN) ? l : FLT_MIN;
+    return (l < FLT_MAX) ? l : FLT_MAX;
+}
+
+// Within 4e-6 of log2() for positive normal floats, a tiny fraction of any
+// bin; the mantissa is taken to [sqrt(1/2), sqrt(2)), where the series needs
+// only four terms
+static inline float fastLog2(float x) {
+    int bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int exponent = ((bits >> 23) & 255) - 127;
+    bits = (bits & 0x007FFFFF) | 0x3F800000;
+    if (bits > 0x3FB504F3) {
+        bits -= 0x00800000;
+        exponent++;
+    }
+    float m;
+    memcpy(&m, &bits, sizeof(m));
+    float t = (m - 1.0f) / (m + 1.0f);
+    float t2 = t * t;
+    return (float)exponent + t * (HDR_LOG_C1 + t2 * (HDR_LOG_C3 + t2 * (HDR_LOG_C5 + t2 * HDR_LOG_C7)));
+}
+
+static inline unsigned char encodeChannel(float c, float ratio, const unsigned char *encode) {
+    float v = c * ratio;
+    v = (v > 0.0f) ? v : 0.0f;
+    v = (v < 1.0f) ? v : 1.0f;
+    return encode[(int)(v * HISTEQ_SRGB_STEPS + 0.5f)];
+}
+
+// Bin position of a log luminance, clamped to [0, bins]
+static inline float binPosition(float logLuma, const HDRMapping *mapping) {
+    float p = (logLuma - mapping->minLog) * mapping->scale;
+    p = (p > 0.0f) ? p : 0.0f;
+    return (p < (float)mapping->bins) ? p : (float)mapping->bins;
+}
+
+static void logLumaScalar(const float *rgb, float *logLuma, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        logLuma[i] = fastLog2(luminance(rgb + i * 3));
+    }
+}
+
+static void toneMapScalar(const float *rgb, unsigned char *r, unsigned char *g, unsigned char *b, size_t count,
+                          const HDRMapping *mapping) {
+    for (size_t i = 0; i < count; i++) {
+        const float *pixel = rgb + i * 3;
+        float l = luminance(pixel);
+        float p = binPosition(fastLog2(l), mapping);
+        int bin = (int)p;
+        bin = (bin < mapping->bins - 1) ? bin : mapping->bins - 1;
+        float fraction = p - (float)bin;
+        float lower = mapping->lut[bin], upper = mapping->lut[bin + 1];
+        float ratio = (lower + fraction * (upper - lower)) / l;
+        r[i] = encodeChannel(pixel[0], ratio, mapping->encode);
+        g[i] = encodeChannel(pixel[1], ratio, mapping->encode);
+        b[i] = encodeChannel(pixel[2], ratio, mapping->encode);
+    }
+}
+
+#ifdef HISTEQ_X86
+// Eight interleaved RGB pixels as three vectors, one gather per channel
+__attribute__((target("avx2")))
+static inline void loadRGB(const float *rgb, __m256 *r, __m256 *g, __m256 *b) {
+    const __m256i stride = _mm256_setr_epi32(0, 3, 6, 9, 12, 15, 18, 21);
+    *r = _mm256_i32gather_ps(rgb, stride, 4);
+    *g = _mm256_i32gather_ps(rgb + 1, stride, 4);
+    *b = _mm256_i32gather_ps(rgb + 2, stride, 4);
+}
+
+__attribute__((target("avx2")))
+static inline __m256 luminanceAVX2(__m256 r, __m256 g, __m256 b) {
+    __m256 l = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(HDR_LUMA_R), r), _mm256_mul_ps(_mm256_set1_ps(HDR_LUMA_G), g)),
+                             _mm256_mul_ps(_mm256_set1_ps(HDR_LUMA_B), b));
+    // max returns its second operand for NaN, like the scalar compare
+    l = _mm256_max_ps(l, _mm256_set1_ps(FLT_MIN));
+    return _mm256_min_ps(l, _mm256_set1_ps(FLT_MAX));
+}
+
+__attribute__((target("avx2")))
+static inline __m256 fastLog2AVX2(__m256 x) {
+    __m256i bits = _mm256_castps_si256(x);
+    __m256i exponent = _mm256_sub_epi32(_mm256_and_si256(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(255)), _mm256_set1_epi32(127));
+    bits = _mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F800000));
+    __m256i high = _mm256_cmpgt_epi32(bits, _mm256_set1_epi32(0x3FB504F3));
+    bits = _mm256_sub_epi32(bits, _mm256_and_si256(high, _mm256_set1_epi32(0x00800000)));
+    exponent = _mm256_sub_epi32(exponent, high);
+    __m256 m = _mm256_castsi256_ps(bits);
+    __m256 t = _mm256_div_ps(_mm256_sub_ps(m, _mm256_set1_ps(1.0f)), _mm256_add_ps(m, _mm256_set1_ps(1.0f)));
+    __m256 t2 = _mm256_mul_ps(t, t);
+    __m256 series = _mm256_add_ps(_mm256_set1_ps(HDR_LOG_C5), _mm256_mul_ps(t2, _mm256_set1_ps(HDR_LOG_C7)));
+    series = _mm256_add_ps(_mm256_set1_ps(HDR_LOG_C3), _mm256_mul_ps(t2, series));
+    series = _mm256_add_ps(_mm256_set1_ps(HDR_LOG_C1), _mm256_mul_ps(t2, series));
+    return _mm256_add_ps(_mm256_cvtepi32_ps(exponent), _mm256_mul_ps(t, series));
+}
+
+__attribute__((target("avx2")))
+static void logLumaAVX2(const float *rgb, float *logLuma, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 r, g, b;
+        loadRGB(rgb + i * 3, &r, &g, &b);
+        _mm256_storeu_ps(logLuma + i, fastLog2AVX2(luminanceAVX2(r, g, b)));
+    }
+    logLumaScalar(rgb + i * 3, logLuma + i, count - i);
+}
+
+// Eight codes from the padded sRGB table
+__attribute__((target("avx2")))
+static inline void encodeAVX2(unsigned char *channel, __m256 c, __m256 ratio, const unsigned char *encode) {
+    __m256 v = _mm256_mul_ps(c, ratio);
+    v = _mm256_min_ps(_mm256_max_ps(v, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+    __m256i index = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_mul_ps(v, _mm256_set1_ps((float)HISTEQ_SRGB_STEPS)), _mm256_set1_ps(0.5f)));
+    __m256i codes = _mm256_and_si256(_mm256_i32gather_epi32((const int *)encode, index, 1), _mm256_set1_epi32(0xFF));
+    __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(codes), _mm256_extracti128_si256(codes, 1));
+    _mm_storel_epi64((__m128i *)channel, _mm_packus_epi16(words, words));
+}
+
+// The piecewise-linear LUT is two gathers and a lerp per eight pixels
+__attribute__((target("avx2")))
+static void toneMapAVX2(const float *rgb, unsigned char *r, unsigned char *g, unsigned char *b, size_t count,
+                        const HDRMapping *mapping) {
+    const __m256 minLog = _mm256_set1_ps(mapping->minLog);
+    const __m256 scale = _mm256_set1_ps(mapping->scale);
+    const __m256 top = _mm256_set1_ps((float)mapping->bins);
+    const __m256i lastBin = _mm256_set1_epi32(mapping->bins - 1);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 red, green, blue;
+        loadRGB(rgb + i * 3, &red, &green, &blue);
+        __m256 l = luminanceAVX2(red, green, blue);
+        __m256 p = _mm256_mul_ps(_mm256_sub_ps(fastLog2AVX2(l), minLog), scale);
+        p = _mm256_min_ps(_mm256_max_ps(p, _mm256_setzero_ps()), top);
+        __m256i bin = _mm256_min_epi32(_mm256_cvttps_epi32(p), lastBin);
+        __m256 fraction = _mm256_sub_ps(p, _mm256_cvtepi32_ps(bin));
+        __m256 lower = _mm256_i32gather_ps(mapping->lut, bin, 4);
+        __m256 upper = _mm256_i32gather_ps(mapping->lut + 1, bin, 4);
+        __m256 ratio = _mm256_div_ps(_mm256_add_ps(lower, _mm256_mul_ps(fraction, _mm256_sub_ps(upper, lower))), l);
+        encodeAVX2(r + i, red, ratio, mapping->encode);
+        encodeAVX2(g + i, green, ratio, mapping->encode);
+        encodeAVX2(b + i, blue, ratio, mapping->encode);
+    }
+    toneMapScalar(rgb + i * 3, r + i, g + i, b + i, count - i, mapping);
+}
+#endif
+
+static LogLumaKernel logLumaKernel = logLumaScalar;
+static ToneMapKernel toneMapKernel = toneMapScalar;
+static pthread_once_t kernelsResolved = PTHREAD_ONCE_INIT;
+
+static void resolveHDRKernels(void) {
+#ifdef HISTEQ_X86
+    if (histeqCPUHasAVX2()) {
+        logLumaKernel = logLumaAVX2;
+        toneMapKernel = toneMapAVX2;
+    }
+#endif
+}
+
+// Output luminance at each bin edge: the CDF up to the edge, taken as an
+// sRGB code and decoded to linear light
+static void buildToneLUT(const int *histogram, int bins, long long totalPixels, float *lut) {
+    long long cumulative = 0;
+    lut[0] = 0.0f;
+    for (int i = 0; i < bins; i++) {
+        cumulative += histogram[i];
+        double code = (double)cumulative / totalPixels;
+        lut[i + 1] = (float)((code <= 0.04045) ? code / 12.92 : pow((code + 0.055) / 1.055, 2.4));
+    }
+}
+
+int histeqEqualizeHDR(const HistEqBackend *backend, const float *rgb, int width, int height, int bins, unsigned char *output) {
+    if (bins < 2 || bins > HISTEQ_HDR_MAX_BINS) {
+        fprintf(stderr, "HDR bin count must be between 2 and %d\n", HISTEQ_HDR_MAX_BINS);
+        return -1;
+    }
+    size_t pixels = (size_t)width * height;
+    if (pixels == 0) {
+        return 0;
+    }
+
+    int *histogram = (int *)calloc(bins, sizeof(int));
+    float *lut = (float *)malloc((bins + 1) * sizeof(float));
+    if (histogram == NULL || lut == NULL) {
+        perror("Memory allocation failed");
+        free(histogram);
+        free(lut);
+        return -1;
+    }
+    pthread_once(&kernelsResolved, resolveHDRKernels);
+    LogLumaKernel logLuma = logLumaKernel;
+    ToneMapKernel toneMap = toneMapKernel;
+
+    // Only the OpenMP backend spreads the tiles over threads
+    int parallel = backend == &histeqOpenMPBackend;
+    long long tiles = (long long)((pixels + HDR_TILE - 1) / HDR_TILE);
+    float minLog = FLT_MAX, maxLog = -FLT_MAX;
+
+    // Pass 1: the log-luminance range
+    #pragma omp parallel for schedule(static) reduction(min:minLog) reduction(max:maxLog) if (parallel)
+    for (long long tile = 0; tile < tiles; tile++) {
+        float logTile[HDR_TILE];
+        size_t begin = (size_t)tile * HDR_TILE;
+        size_t count = (pixels - begin < HDR_TILE) ? pixels - begin : HDR_TILE;
+        logLuma(rgb + begin * 3, logTile, count);
+        for (size_t i = 0; i < count; i++) {
+            minLog = (logTile[i] < minLog) ? logTile[i] : minLog;
+            maxLog = (logTile[i] > maxLog) ? logTile[i] : maxLog;
+        }
+    }
+    if (minLog < maxLog - HDR_MAX_STOPS) {
+        minLog = maxLog - HDR_MAX_STOPS;
+    }
+
+    HDRMapping mapping;
+    mapping.minLog = minLog;
+    // A flat image gets a range of one stop, so it lands in the first bin
+    mapping.scale = bins / ((maxLog > minLog) ? maxLog - minLog : 1.0f);
+    mapping.bins = bins;
+    mapping.lut = lut;
+    mapping.encode = histeqLinearToSRGB();
+
+    // Pass 2: the histogram, per thread and then merged
+    HistEqPartials partials;
+    if (histeqAllocPartials(&partials, parallel ? omp_get_max_threads() : 1, (size_t)bins) != 0) {
+        perror("Memory allocation failed");
+        free(histogram);
+        free(lut);
+        return -1;
+    }
+    #pragma omp parallel if (parallel)
+    {
+        int *local = histeqPartialRow(&partials);
+
+        #pragma omp for schedule(static) nowait
+        for (long long tile = 0; tile < tiles; tile++) {
+            float logTile[HDR_TILE];
+            size_t begin = (size_t)tile * HDR_TILE;
+            size_t count = (pixels - begin < HDR_TILE) ? pixels - begin : HDR_TILE;
+            logLuma(rgb + begin * 3, logTile, count);
+            for (size_t i = 0; i < count; i++) {
+                int bin = (int)binPosition(logTile[i], &mapping);
+                local[(bin < bins - 1) ? bin : bins - 1]++;
+            }
+        }
+
+        histeqReduceHistograms(&partials, histogram);
+    }
+    histeqFreePartials(&partials);
+    buildToneLUT(histogram, bins, (long long)pixels, lut);
+
+    // Pass 3: tone map into planar codes and interleave them into the output
+    #pragma omp parallel for schedule(static) if (parallel)
+    for (long long tile = 0; tile < tiles; tile++) {
+        unsigned char r[HDR_TILE], g[HDR_TILE], b[HDR_TILE];
+        size_t begin = (size_t)tile * HDR_TILE;
+        size_t count = (pixels - begin < HDR_TILE) ? pixels - begin : HDR_TILE;
+        toneMap(rgb + begin * 3, r, g, b, count, &mapping);
+        histeqMergeRGBRow(r, g, b, output + begin * 3, count);
+    }
+
+    free(histogram);
+    free(lut);
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <png.h>
+#include "histeq_internal.h"
+
+// stb_image is compiled in here with internal linkage, so programs that
+// carry their own copy (the CUDA versions) still link against the library
+#define STB_IMAGE_STATIC
+#define STB_IMAGE_IMPLEMENTATION
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function"
+#include "../parallel-code/stb_image.h"
+#pragma GCC diagnostic pop
+
+int histeqReadImage16(const char *filename, unsigned short **data, int *width, int *height, int *components) {
+    int stored;
+    if (!stbi_info(filename, width, height, &stored)) {
+        fprintf(stderr, "Error reading '%s': %s\n", filename, stbi_failure_reason());
+        return -1;
+    }
+
+    // Gray and gray + alpha load as gray, everything else as RGB; 8-bit
+    // files are widened to 16 bits
+    int wanted = (stored <= 2) ? 1 : 3;
+    *data = stbi_load_16(filename, width, height, &stored, wanted);
+    if (*data == NULL) {
+        fprintf(stderr, "Error reading '%s': %s\n", filename, stbi_failure_reason());
+        return -1;
+    }
+    *components = wanted;
+    return 0;
+}
+
+int histeqReadImageHDR(const char *filename, float **data, int *width, int *height) {
+    int stored;
+    *data = stbi_loadf(filename, width, height, &stored, 3);
+    if (*data == NULL) {
+        fprintf(stderr, "Error reading '%s': %s\n", filename, stbi_failure_reason());
+        return -1;
+    }
+    return 0;
+}
+
+// 8 or 16 bits per sample; 16-bit rows are in host order
+static int writePNG(const char *filename, const void *data, int width, int height, int components, int depth) {
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening file '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = (png != NULL) ? png_create_info_struct(png) : NULL;
+    if (info == NULL) {
+        fprintf(stderr, "Error writing '%s': out of memory\n", filename);
+        png_destroy_write_struct(&png, NULL);
+        fclose(file);
+        remove(filename);
+        return -1;
+    }
+    // libpng has already printed the reason when it jumps back here
+    if (setjmp(png_jmpbuf(png))) {
+        png_destroy_write_struct(&png, &info);
+        fclose(file);
+        remove(filename);
+        return -1;
+    }
+
+    png_init_io(png, file);
+    png_set_IHDR(png, info, width, height, depth, (components == 1) ? PNG_COLOR_TYPE_GRAY : PNG_COLOR_TYPE_RGB,
+                 PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+    // PNG stores samples big-endian
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (depth == 16) {
+        png_set_swap(png);
+    }
+#endif
+    size_t rowBytes = (size_t)width * components * (depth / 8);
+    for (int y = 0; y < height; y++) {
+        png_write_row(png, (png_const_bytep)data + (size_t)y * rowBytes);
+    }
+    png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &info);
+
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Error writing '%s': %s\n", filename, strerror(errno));
+        remove(filename);
+        return -1;
+    }
+    return 0;
+}
+
+int histeqWritePNG16(const char *filename, const unsigned short *data, int width, int height, int components) {
+    return writePNG(filename, data, width, height, components, 16);
+}
+
+int histeqWritePNG(const char *filename, const unsigned char *data, int width, int height, int components) {
+    return writePNG(filename, data, width, height, components, 8);
+}
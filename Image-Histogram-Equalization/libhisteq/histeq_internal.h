@@ -0,0 +1,102 @@
+#ifndef HISTEQ_INTERNAL_H
+#define HISTEQ_INTERNAL_H
+
+#include "histeq.h"
+
+// Luma mode shared by every backend (histeq.c)
+extern HistEqLumaMode histeqLumaMode;
+
+// Gray value of an RGB pixel, same expression the original programs used
+static inline unsigned char histeqLumaExact(const unsigned char *pixel) {
+    return (unsigned char)((pixel[0] * 0.299) + (pixel[1] * 0.587) + (pixel[2] * 0.114));
+}
+
+static inline unsigned char histeqLumaFast(const unsigned char *pixel) {
+    return (unsigned char)((HISTEQ_LUMA_FAST_R * pixel[0] + HISTEQ_LUMA_FAST_G * pixel[1] + HISTEQ_LUMA_FAST_B * pixel[2]) >> 8);
+}
+
+static inline unsigned char histeqLuma(const unsigned char *pixel) {
+    return (histeqLumaMode == HISTEQ_LUMA_FAST) ? histeqLumaFast(pixel) : histeqLumaExact(pixel);
+}
+
+// Compares a derived "after" histogram with a scanned one and, on a mismatch,
+// reports the first bad bin and keeps the scanned histogram (histeq.c)
+void histeqCheckHistogramAfter(const int scanned[HISTEQ_BINS], int histogramAfter[HISTEQ_BINS]);
+
+// CPU support for the vector kernels, capped by HISTEQ_ISA=scalar|avx2|avx512vbmi
+// (histeq_simd.c). Every kernel resolver asks these, so the override means the
+// same everywhere; all return 0 off x86. FMA is only needed by the DCT.
+int histeqCPUHasAVX2(void);
+int histeqCPUHasFMA(void);
+int histeqCPUHasAVX512VBMI(void);
+
+// Visible size of a JPEG component plane: the image size scaled by the
+// component's sampling factor over the largest one, rounded up as libjpeg
+// does. Y is not always at the largest factor (Y 1x1 with Cb 2x2 is legal).
+static inline int histeqSampledSize(int size, int samp, int maxSamp) {
+    return (int)(((long long)size * samp + maxSamp - 1) / maxSamp);
+}
+
+// Visible width and height of plane 0 of a planar image (histeq_io.c); -1
+// with a message if the plane is too small to hold them
+int histeqPlanarLumaSize(const HistEqPlanarImage *image, int *width, int *height);
+
+// 8x8 DCT of one block, with the JPEG level shift of 128 (histeq_dct.c).
+// Coefficients and quantization steps are in natural (row-major) order, as
+// libjpeg keeps them in a JBLOCK; pixels are 8 rows `stride` bytes apart.
+void histeqIDCTBlock(const short coefficients[64], const unsigned short quant[64], unsigned char *pixels, size_t stride);
+void histeqFDCTBlock(const unsigned char *pixels, size_t stride, const unsigned short quant[64], short coefficients[64]);
+
+// Interleaved RGB to three planes and back, with the pshufb kernels of the
+// luma path (histeq_simd.c)
+void histeqSplitRGBRow(const unsigned char *rgb, unsigned char *r, unsigned char *g, unsigned char *b, size_t pixels);
+void histeqMergeRGBRow(const unsigned char *r, const unsigned char *g, const unsigned char *b, unsigned char *rgb, size_t pixels);
+
+// sRGB encoding of linear light in [0, 1], shared by the Lab and HDR paths
+// (histeq_colour.c): entry round(c * HISTEQ_SRGB_STEPS) holds the 8-bit code
+// of c. Built on first use; it is padded so 32-bit gathers at the last entry
+// stay inside it.
+#define HISTEQ_SRGB_STEPS 16384
+
+const unsigned char *histeqLinearToSRGB(void);
+
+// Backend kernel tables
+extern const HistEqBackend histeqScalarBackend;
+extern const HistEqBackend histeqOpenMPBackend;
+extern const HistEqBackend histeqSIMDBackend;
+
+// Scalar kernels, shared by the other backends for their tails and fallbacks
+void histeqScalarHistogram(const unsigned char *data, size_t pixels, int components, int histogram[HISTEQ_BINS]);
+void histeqScalarApplyLUT(unsigned char *data, size_t pixels, int components, const unsigned char lut[HISTEQ_BINS]);
+void histeqScalarLumaHistogram(const unsigned char *rgb, unsigned char *gray, size_t pixels, int histogram[HISTEQ_BINS]);
+void histeqScalarApplyLUTGray(unsigned char *gray, unsigned char *rgb, size_t pixels, const unsigned char lut[HISTEQ_BINS]);
+
+// Adds a slice of 1- or 3-component pixels to `histogram` with the vector kernels
+void histeqHistogramSlice(const unsigned char *data, size_t pixels, int components, int histogram[HISTEQ_BINS]);
+
+// Fused RGB kernels over a slice, built on the vector row kernels (histeq_simd.c).
+// histeqLumaHistogramSlice adds to `histogram`.
+void histeqLumaHistogramSlice(const unsigned char *rgb, unsigned char *gray, size_t pixels, int histogram[HISTEQ_BINS]);
+void histeqApplyLUTGraySlice(unsigned char *gray, unsigned char *rgb, size_t pixels, const unsigned char lut[HISTEQ_BINS]);
+
+// Per-thread histograms of a parallel region (histeq_openmp.c): one row of
+// `bins` counts per thread, each starting on its own cache line, so counting
+// never shares a line between threads. Each thread takes its row with
+// histeqPartialRow(), which clears it, and counts into it. Then every thread
+// of the team calls histeqReduceHistograms(). It waits for the others and
+// adds a range of whole cache lines, summed over all rows, to `histogram`, so
+// the merge is spread over the team instead of taken in turns.
+typedef struct {
+    int *rows;
+    size_t stride;      // ints from one row to the next
+    size_t bins;
+    int threads;
+} HistEqPartials;
+
+// Rows for `threads` threads; returns 0, or -1 if out of memory
+int histeqAllocPartials(HistEqPartials *partials, int threads, size_t bins);
+void histeqFreePartials(HistEqPartials *partials);
+int *histeqPartialRow(const HistEqPartials *partials);
+void histeqReduceHistograms(const HistEqPartials *partials, int *histogram);
+
+#endif
@@ -0,0 +1,1011 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <jpeglib.h>
+#include <jerror.h>
+#include "histeq_internal.h"
+
+// libjpeg reports fatal errors through error_exit, which normally calls
+// exit(). Jump back to the caller instead so one bad file doesn't end a batch.
+typedef struct {
+    struct jpeg_error_mgr pub;
+    jmp_buf setjmp_buffer;
+} ErrorManager;
+
+static void errorExit(j_common_ptr cinfo) {
+    ErrorManager *err = (ErrorManager *)cinfo->err;
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(err->setjmp_buffer, 1);
+}
+
+// Scanlines handed to libjpeg per call. One row per call spends a noticeable
+// share of decode/encode time in per-call overhead (benchmarks/jpeg_io_bench.c);
+// a few dozen rows lets the codec work through whole iMCU rows at a time.
+#define IO_BATCH_ROWS 32
+
+// Reads the next `rows` scanlines into a buffer. libjpeg may return fewer
+// lines than asked for, so keep calling until all of them are in.
+static void readRows(struct jpeg_decompress_struct *cinfo, unsigned char *buffer, int rows, int rowStride) {
+    JSAMPROW row_pointers[IO_BATCH_ROWS];
+    for (int done = 0; done < rows; ) {
+        int batch = (rows - done < IO_BATCH_ROWS) ? rows - done : IO_BATCH_ROWS;
+        for (int i = 0; i < batch; i++) {
+            row_pointers[i] = buffer + (size_t)(done + i) * rowStride;
+        }
+        done += jpeg_read_scanlines(cinfo, row_pointers, batch);
+    }
+}
+
+static void writeRows(struct jpeg_compress_struct *cinfo, const unsigned char *buffer, int rows, int rowStride) {
+    JSAMPROW row_pointers[IO_BATCH_ROWS];
+    for (int done = 0; done < rows; ) {
+        int batch = (rows - done < IO_BATCH_ROWS) ? rows - done : IO_BATCH_ROWS;
+        for (int i = 0; i < batch; i++) {
+            row_pointers[i] = (JSAMPROW)buffer + (size_t)(done + i) * rowStride;
+        }
+        done += jpeg_write_scanlines(cinfo, row_pointers, batch);
+    }
+}
+
+// Destination manager that writes into a HistEqMemoryBuffer, doubling it with
+// realloc when it is growable and full
+typedef struct {
+    struct jpeg_destination_mgr pub;
+    HistEqMemoryBuffer *output;
+    // libjpeg asks for more room as soon as the buffer is full, even if the
+    // last byte has been written. A fixed buffer continues into `spill`, and
+    // it is only an error if something actually lands there.
+    JOCTET spill[16];
+    int spilled;
+} MemoryDestination;
+
+#define MEMORY_INITIAL_CAPACITY 65536
+
+static void initMemoryDestination(j_compress_ptr cinfo) {
+    MemoryDestination *dest = (MemoryDestination *)cinfo->dest;
+    HistEqMemoryBuffer *output = dest->output;
+    if (output->data == NULL && output->growable) {
+        output->capacity = MEMORY_INITIAL_CAPACITY;
+        output->data = (unsigned char *)malloc(output->capacity);
+        if (output->data == NULL) {
+            output->capacity = 0;
+            ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 10);
+        }
+    }
+    if (output->data == NULL || output->capacity == 0) {
+        ERREXIT(cinfo, JERR_BUFFER_SIZE);
+    }
+    output->size = 0;
+    dest->spilled = 0;
+    dest->pub.next_output_byte = output->data;
+    dest->pub.free_in_buffer = output->capacity;
+}
+
+static boolean emptyMemoryDestination(j_compress_ptr cinfo) {
+    MemoryDestination *dest = (MemoryDestination *)cinfo->dest;
+    HistEqMemoryBuffer *output = dest->output;
+    if (!output->growable) {
+        if (dest->spilled) {
+            ERREXIT(cinfo, JERR_BUFFER_SIZE);
+        }
+        dest->spilled = 1;
+        dest->pub.next_output_byte = dest->spill;
+        dest->pub.free_in_buffer = sizeof(dest->spill);
+        return TRUE;
+    }
+
+    // libjpeg only calls this when the buffer is completely full
+    size_t used = output->capacity;
+    unsigned char *grown = (unsigned char *)realloc(output->data, output->capacity * 2);
+    if (grown == NULL) {
+        ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 10);
+    }
+    output->data = grown;
+    output->capacity *= 2;
+    dest->pub.next_output_byte = grown + used;
+    dest->pub.free_in_buffer = output->capacity - used;
+    return TRUE;
+}
+
+static void termMemoryDestination(j_compress_ptr cinfo) {
+    MemoryDestination *dest = (MemoryDestination *)cinfo->dest;
+    if (dest->spilled) {
+        if (dest->pub.free_in_buffer < sizeof(dest->spill)) {
+            ERREXIT(cinfo, JERR_BUFFER_SIZE);
+        }
+        dest->output->size = dest->output->capacity;
+    } else {
+        dest->output->size = dest->output->capacity - dest->pub.free_in_buffer;
+    }
+}
+
+// Decodes a whole image from `file`, or from the jpeg/jpegSize buffer when
+// file is NULL. `name` is only used in error messages.
+static int decodeJPEG(FILE *file, const unsigned char *jpeg, size_t jpegSize, const char *name,
+                      unsigned char **data, int *width, int *height, int *color_space) {
+    struct jpeg_decompress_struct cinfo;
+    ErrorManager jerr;
+    unsigned char *volatile buffer = NULL;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = errorExit;
+    if (setjmp(jerr.setjmp_buffer)) {
+        fprintf(stderr, "Error decoding %s\n", name);
+        jpeg_destroy_decompress(&cinfo);
+        free(buffer);
+        return -1;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    if (file != NULL) {
+        jpeg_stdio_src(&cinfo, file);
+    } else {
+        jpeg_mem_src(&cinfo, jpeg, (unsigned long)jpegSize);
+    }
+    jpeg_read_header(&cinfo, TRUE);
+    jpeg_start_decompress(&cinfo);
+
+    int row_stride = cinfo.output_width * cinfo.output_components;
+    buffer = (unsigned char *)malloc((size_t)row_stride * cinfo.output_height);
+    if (buffer == NULL) {
+        perror("Memory allocation failed");
+        jpeg_destroy_decompress(&cinfo);
+        return -1;
+    }
+
+    readRows(&cinfo, buffer, cinfo.output_height, row_stride);
+
+    *data = buffer;
+    *width = cinfo.output_width;
+    *height = cinfo.output_height;
+    *color_space = cinfo.out_color_space;
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    return 0;
+}
+
+// Encodes an image to `file`, or into `output` when file is NULL
+static int encodeJPEG(FILE *file, HistEqMemoryBuffer *output, const char *name,
+                      const unsigned char *data, int width, int height, int color_space) {
+    struct jpeg_compress_struct cinfo;
+    ErrorManager jerr;
+    MemoryDestination dest;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = errorExit;
+    if (setjmp(jerr.setjmp_buffer)) {
+        fprintf(stderr, "Error encoding %s\n", name);
+        jpeg_destroy_compress(&cinfo);
+        return -1;
+    }
+
+    jpeg_create_compress(&cinfo);
+    if (file != NULL) {
+        jpeg_stdio_dest(&cinfo, file);
+    } else {
+        dest.pub.init_destination = initMemoryDestination;
+        dest.pub.empty_output_buffer = emptyMemoryDestination;
+        dest.pub.term_destination = termMemoryDestination;
+        dest.output = output;
+        cinfo.dest = &dest.pub;
+    }
+
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = (color_space == JCS_GRAYSCALE) ? 1 : 3;
+    cinfo.in_color_space = color_space;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 75, TRUE);
+
+    jpeg_start_compress(&cinfo, TRUE);
+    int row_stride = width * cinfo.input_components;
+    writeRows(&cinfo, data, height, row_stride);
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    return 0;
+}
+
+// -1 until set or read from the environment
+static int mappedInput = -1;
+
+void histeqSetMappedInput(int enabled) {
+    mappedInput = enabled;
+}
+
+int histeqGetMappedInput(void) {
+    if (mappedInput < 0) {
+        const char *value = getenv("HISTEQ_MMAP");
+        mappedInput = value == NULL || strcmp(value, "0") != 0;
+    }
+    return mappedInput;
+}
+
+// Below this size stdio reads the file in one or two read() calls, which is
+// cheaper than setting up and tearing down a mapping (benchmarks/read_bench.c)
+#define MAP_MIN_SIZE 65536
+
+// Maps a regular file of at least `minSize` bytes and asks for sequential
+// read-ahead of all of it, since the decoder reads it front to back once.
+// Returns -1 without a message when the file isn't mapped.
+static int mapFile(int fd, size_t minSize, const unsigned char **data, size_t *size) {
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0 || (size_t)st.st_size < minSize) {
+        return -1;
+    }
+    void *mapped = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapped == MAP_FAILED) {
+        return -1;
+    }
+    madvise(mapped, (size_t)st.st_size, MADV_SEQUENTIAL);
+    madvise(mapped, (size_t)st.st_size, MADV_WILLNEED);
+
+    *data = (const unsigned char *)mapped;
+    *size = (size_t)st.st_size;
+    return 0;
+}
+
+int histeqReadJPEG(const char *filename, unsigned char **data, int *width, int *height, int *color_space) {
+    HISTEQ_TRACE_SCOPE("readJPEG");
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Error opening file '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    char name[4096];
+    snprintf(name, sizeof(name), "'%s'", filename);
+
+    const unsigned char *mapped;
+    size_t mappedSize;
+    if (histeqGetMappedInput() && mapFile(fd, MAP_MIN_SIZE, &mapped, &mappedSize) == 0) {
+        close(fd);
+        int status = decodeJPEG(NULL, mapped, mappedSize, name, data, width, height, color_space);
+        munmap((void *)mapped, mappedSize);
+        return status;
+    }
+
+    // Small files, pipes, devices and anything else that can't be mapped go through stdio
+    FILE *file = fdopen(fd, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening file '%s': %s\n", filename, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    int status = decodeJPEG(file, NULL, 0, name, data, width, height, color_space);
+    fclose(file);
+    return status;
+}
+
+int histeqWriteJPEG(const char *filename, const unsigned char *data, int width, int height, int color_space) {
+    HISTEQ_TRACE_SCOPE("writeJPEG");
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening file '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    char name[4096];
+    snprintf(name, sizeof(name), "'%s'", filename);
+    if (encodeJPEG(file, NULL, name, data, width, height, color_space) != 0) {
+        fclose(file);
+        remove(filename);
+        return -1;
+    }
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Error writing '%s': %s\n", filename, strerror(errno));
+        remove(filename);
+        return -1;
+    }
+    return 0;
+}
+
+int histeqReadJPEGMemory(const unsigned char *jpeg, size_t jpegSize, unsigned char **data, int *width, int *height, int *color_space) {
+    return decodeJPEG(NULL, jpeg, jpegSize, "JPEG buffer", data, width, height, color_space);
+}
+
+int histeqWriteJPEGMemory(HistEqMemoryBuffer *output, const unsigned char *data, int width, int height, int color_space) {
+    return encodeJPEG(NULL, output, "into JPEG buffer", data, width, height, color_space);
+}
+
+int histeqEqualizeJPEGMemory(const HistEqBackend *backend, const unsigned char *input, size_t inputSize, HistEqMemoryBuffer *output,
+                             int histogramBefore[HISTEQ_BINS], int histogramAfter[HISTEQ_BINS]) {
+    unsigned char *data = NULL;
+    int width, height, color_space;
+
+    if (histeqReadJPEGMemory(input, inputSize, &data, &width, &height, &color_space) != 0) {
+        return -1;
+    }
+    if (color_space != JCS_GRAYSCALE && color_space != JCS_RGB) {
+        fprintf(stderr, "Unsupported colour space in JPEG buffer\n");
+        free(data);
+        return -1;
+    }
+
+    int components = (color_space == JCS_GRAYSCALE) ? 1 : 3;
+    histeqEqualize(backend, data, width, height, components, histogramBefore, histogramAfter);
+    int status = histeqWriteJPEGMemory(output, data, width, height, color_space);
+    free(data);
+    return status;
+}
+
+int histeqMapFile(const char *filename, const unsigned char **data, size_t *size) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    int status = mapFile(fd, 1, data, size);
+    close(fd);
+    return status;
+}
+
+void histeqUnmapFile(const unsigned char *data, size_t size) {
+    munmap((void *)data, size);
+}
+
+int histeqStreamHistogram(const HistEqBackend *backend, const char *filename, int stripHeight,
+                          int histogram[HISTEQ_BINS], int *width, int *height, int *color_space) {
+    return histeqStreamHistogramScaled(backend, filename, stripHeight, 1, histogram, NULL, width, height, color_space);
+}
+
+int histeqStreamHistogramScaled(const HistEqBackend *backend, const char *filename, int stripHeight, int scaleDenom,
+                                int histogram[HISTEQ_BINS], long long *samples, int *width, int *height, int *color_space) {
+    struct jpeg_decompress_struct cinfo;
+    ErrorManager jerr;
+    unsigned char *volatile strip = NULL;
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening file '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = errorExit;
+    if (setjmp(jerr.setjmp_buffer)) {
+        fprintf(stderr, "Error decoding '%s'\n", filename);
+        jpeg_destroy_decompress(&cinfo);
+        fclose(file);
+        free(strip);
+        return -1;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, file);
+    jpeg_read_header(&cinfo, TRUE);
+    if (scaleDenom > 1) {
+        // The reduced-size IDCTs only keep the low-frequency coefficients; at
+        // 1/8 each 8x8 block becomes its DC value. Precision is already given
+        // up, so take the fast paths for the rest of the decode too.
+        cinfo.scale_num = 1;
+        cinfo.scale_denom = scaleDenom;
+        cinfo.dct_method = JDCT_IFAST;
+        cinfo.do_fancy_upsampling = FALSE;
+    }
+    jpeg_start_decompress(&cinfo);
+
+    int components = cinfo.output_components;
+    if (components != 1 && components != 3) {
+        fprintf(stderr, "Unsupported colour space in '%s'\n", filename);
+        jpeg_destroy_decompress(&cinfo);
+        fclose(file);
+        return -1;
+    }
+
+    int stripRows = (stripHeight > 0) ? stripHeight : HISTEQ_STRIP_HEIGHT;
+    int row_stride = cinfo.output_width * components;
+    strip = (unsigned char *)malloc((size_t)row_stride * stripRows);
+    if (strip == NULL) {
+        perror("Memory allocation failed");
+        jpeg_destroy_decompress(&cinfo);
+        fclose(file);
+        return -1;
+    }
+
+    memset(histogram, 0, HISTEQ_BINS * sizeof(int));
+    while (cinfo.output_scanline < cinfo.output_height) {
+        int rows = cinfo.output_height - cinfo.output_scanline;
+        if (rows > stripRows) {
+            rows = stripRows;
+        }
+        readRows(&cinfo, strip, rows, row_stride);
+
+        int stripHistogram[HISTEQ_BINS];
+        backend->computeHistogram(strip, (size_t)cinfo.output_width * rows, components, stripHistogram);
+        for (int i = 0; i < HISTEQ_BINS; i++) {
+            histogram[i] += stripHistogram[i];
+        }
+    }
+
+    if (samples != NULL) {
+        *samples = (long long)cinfo.output_width * cinfo.output_height;
+    }
+    *width = cinfo.image_width;
+    *height = cinfo.image_height;
+    *color_space = cinfo.out_color_space;
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    fclose(file);
+    free(strip);
+    return 0;
+}
+
+int histeqStreamApplyLUT(const HistEqBackend *backend, const char *inputFile, const char *outputFile, int stripHeight,
+                         const unsigned char lut[HISTEQ_BINS], int histogramAfter[HISTEQ_BINS]) {
+    struct jpeg_decompress_struct dinfo;
+    struct jpeg_compress_struct cinfo;
+    ErrorManager jerr;
+    unsigned char *volatile strip = NULL;
+    FILE *volatile output = NULL;
+    FILE *input = fopen(inputFile, "rb");
+    if (input == NULL) {
+        fprintf(stderr, "Error opening file '%s': %s\n", inputFile, strerror(errno));
+        return -1;
+    }
+
+    // Both objects share one error manager, so a failure on either side lands
+    // here, including one while creating them; destroying an object whose
+    // memory manager is still NULL does nothing
+    dinfo.err = jpeg_std_error(&jerr.pub);
+    cinfo.err = &jerr.pub;
+    jerr.pub.error_exit = errorExit;
+    dinfo.mem = NULL;
+    cinfo.mem = NULL;
+    if (setjmp(jerr.setjmp_buffer)) {
+        fprintf(stderr, "Error equalizing '%s' into '%s'\n", inputFile, outputFile);
+        jpeg_destroy_compress(&cinfo);
+        jpeg_destroy_decompress(&dinfo);
+        fclose(input);
+        if (output != NULL) {
+            fclose(output);
+            remove(outputFile);
+        }
+        free(strip);
+        return -1;
+    }
+
+    jpeg_create_decompress(&dinfo);
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_src(&dinfo, input);
+    jpeg_read_header(&dinfo, TRUE);
+    jpeg_start_decompress(&dinfo);
+
+    int components = dinfo.output_components;
+    int stripRows = (stripHeight > 0) ? stripHeight : HISTEQ_STRIP_HEIGHT;
+    int row_stride = dinfo.output_width * components;
+    strip = (unsigned char *)malloc((size_t)row_stride * stripRows);
+    output = fopen(outputFile, "wb");
+    if (strip == NULL || output == NULL || (components != 1 && components != 3)) {
+        if (output == NULL) {
+            fprintf(stderr, "Error opening file '%s': %s\n", outputFile, strerror(errno));
+        } else if (strip == NULL) {
+            perror("Memory allocation failed");
+        } else {
+            fprintf(stderr, "Unsupported colour space in '%s'\n", inputFile);
+        }
+        longjmp(jerr.setjmp_buffer, 1);
+    }
+
+    jpeg_stdio_dest(&cinfo, output);
+    cinfo.image_width = dinfo.output_width;
+    cinfo.image_height = dinfo.output_height;
+    cinfo.input_components = components;
+    cinfo.in_color_space = dinfo.out_color_space;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 75, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    if (histogramAfter != NULL) {
+        memset(histogramAfter, 0, HISTEQ_BINS * sizeof(int));
+    }
+    while (dinfo.output_scanline < dinfo.output_height) {
+        int rows = dinfo.output_height - dinfo.output_scanline;
+        if (rows > stripRows) {
+            rows = stripRows;
+        }
+        readRows(&dinfo, strip, rows, row_stride);
+
+        size_t pixels = (size_t)dinfo.output_width * rows;
+        backend->applyLUT(strip, pixels, components, lut);
+        if (histogramAfter != NULL) {
+            int stripHistogram[HISTEQ_BINS];
+            backend->computeHistogram(strip, pixels, components, stripHistogram);
+            for (int i = 0; i < HISTEQ_BINS; i++) {
+                histogramAfter[i] += stripHistogram[i];
+            }
+        }
+
+        writeRows(&cinfo, strip, rows, row_stride);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_finish_decompress(&dinfo);
+    jpeg_destroy_compress(&cinfo);
+    jpeg_destroy_decompress(&dinfo);
+    fclose(input);
+    free(strip);
+    if (fclose(output) != 0) {
+        fprintf(stderr, "Error writing '%s': %s\n", outputFile, strerror(errno));
+        remove(outputFile);
+        return -1;
+    }
+    return 0;
+}
+
+int histeqEqualizeStreaming(const HistEqBackend *backend, const char *inputFile, const char *outputFile, int stripHeight,
+                            int histogramBefore[HISTEQ_BINS], int histogramAfter[HISTEQ_BINS]) {
+    int histogram[HISTEQ_BINS];
+    unsigned char lut[HISTEQ_BINS];
+    int width, height, color_space;
+
+    if (histeqStreamHistogram(backend, inputFile, stripHeight, histogram, &width, &height, &color_space) != 0) {
+        return -1;
+    }
+    histeqBuildLUT(histogram, (long long)width * height, lut);
+
+    int components = (color_space == JCS_GRAYSCALE) ? 1 : 3;
+    int scanned[HISTEQ_BINS];
+    int validate = histogramAfter != NULL && histeqGetValidation();
+    if (histeqStreamApplyLUT(backend, inputFile, outputFile, stripHeight, lut, validate ? scanned : NULL) != 0) {
+        return -1;
+    }
+
+    if (histogramBefore != NULL) {
+        memcpy(histogramBefore, histogram, sizeof(histogram));
+    }
+    if (histogramAfter != NULL) {
+        histeqHistogramFromLUT(histogram, lut, components, histogramAfter);
+        if (validate) {
+            histeqCheckHistogramAfter(scanned, histogramAfter);
+        }
+    }
+    return 0;
+}
+
+// Rows of one component in one iMCU row, the unit of jpeg_read_raw_data and
+// jpeg_write_raw_data. Sampling factors are at most 4, so 32 rows at most.
+#define MAX_RAW_ROWS (4 * DCTSIZE)
+
+static void rawRowPointers(const HistEqPlanarImage *image, int component, int iMCURow, JSAMPROW rows[MAX_RAW_ROWS]) {
+    int count = image->vSamp[component] * DCTSIZE;
+    for (int r = 0; r < count; r++) {
+        rows[r] = image->planes[component] + ((size_t)iMCURow * count + r) * image->planeWidth[component];
+    }
+}
+
+int histeqReadJPEGPlanar(const char *filename, HistEqPlanarImage *image) {
+    struct jpeg_decompress_struct cinfo;
+    ErrorManager jerr;
+    unsigned char *volatile block = NULL;
+    FILE *file = fopen(filename, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening file '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = errorExit;
+    if (setjmp(jerr.setjmp_buffer)) {
+        fprintf(stderr, "Error decoding '%s'\n", filename);
+        jpeg_destroy_decompress(&cinfo);
+        fclose(file);
+        free(block);
+        return -1;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_stdio_src(&cinfo, file);
+    jpeg_read_header(&cinfo, TRUE);
+    if (cinfo.jpeg_color_space != JCS_YCbCr && cinfo.jpeg_color_space != JCS_GRAYSCALE) {
+        fprintf(stderr, "'%s' is not a YCbCr or grayscale JPEG\n", filename);
+        jpeg_destroy_decompress(&cinfo);
+        fclose(file);
+        return -1;
+    }
+
+    // Hand back the planes as stored: no upsampling, no colour conversion
+    cinfo.raw_data_out = TRUE;
+    cinfo.out_color_space = cinfo.jpeg_color_space;
+    jpeg_start_decompress(&cinfo);
+
+    memset(image, 0, sizeof(*image));
+    image->width = cinfo.image_width;
+    image->height = cinfo.image_height;
+    image->components = cinfo.num_components;
+    image->color_space = cinfo.jpeg_color_space;
+
+    // Planes cover whole iMCU rows, which is what the raw calls read and write
+    size_t offsets[3];
+    size_t total = 0;
+    for (int ci = 0; ci < image->components; ci++) {
+        jpeg_component_info *component = &cinfo.comp_info[ci];
+        image->hSamp[ci] = component->h_samp_factor;
+        image->vSamp[ci] = component->v_samp_factor;
+        image->planeWidth[ci] = component->width_in_blocks * DCTSIZE;
+        image->planeHeight[ci] = cinfo.total_iMCU_rows * component->v_samp_factor * DCTSIZE;
+        offsets[ci] = total;
+        total += (size_t)image->planeWidth[ci] * image->planeHeight[ci];
+    }
+    block = (unsigned char *)malloc(total);
+    if (block == NULL) {
+        perror("Memory allocation failed");
+        jpeg_destroy_decompress(&cinfo);
+        fclose(file);
+        return -1;
+    }
+    for (int ci = 0; ci < image->components; ci++) {
+        image->planes[ci] = block + offsets[ci];
+    }
+
+    JSAMPROW rows[3][MAX_RAW_ROWS];
+    JSAMPARRAY planes[3] = {rows[0], rows[1], rows[2]};
+    int iMCUHeight = cinfo.max_v_samp_factor * DCTSIZE;
+    while (cinfo.output_scanline < cinfo.output_height) {
+        for (int ci = 0; ci < image->components; ci++) {
+            rawRowPointers(image, ci, cinfo.output_scanline / iMCUHeight, rows[ci]);
+        }
+        jpeg_read_raw_data(&cinfo, planes, iMCUHeight);
+    }
+
+    jpeg_finish_decompress(&cinfo);
+    jpeg_destroy_decompress(&cinfo);
+    fclose(file);
+    return 0;
+}
+
+int histeqWriteJPEGPlanar(const char *filename, const HistEqPlanarImage *image) {
+    struct jpeg_compress_struct cinfo;
+    ErrorManager jerr;
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening file '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = errorExit;
+    if (setjmp(jerr.setjmp_buffer)) {
+        fprintf(stderr, "Error encoding '%s'\n", filename);
+        jpeg_destroy_compress(&cinfo);
+        fclose(file);
+        remove(filename);
+        return -1;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, file);
+
+    cinfo.image_width = image->width;
+    cinfo.image_height = image->height;
+    cinfo.input_components = image->components;
+    cinfo.in_color_space = image->color_space;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_colorspace(&cinfo, image->color_space);
+    jpeg_set_quality(&cinfo, 75, TRUE);
+
+    // Keep the input's chroma subsampling so the planes fit unchanged
+    cinfo.raw_data_in = TRUE;
+    for (int ci = 0; ci < image->components; ci++) {
+        cinfo.comp_info[ci].h_samp_factor = image->hSamp[ci];
+        cinfo.comp_info[ci].v_samp_factor = image->vSamp[ci];
+    }
+
+    jpeg_start_compress(&cinfo, TRUE);
+    JSAMPROW rows[3][MAX_RAW_ROWS];
+    JSAMPARRAY planes[3] = {rows[0], rows[1], rows[2]};
+    int iMCUHeight = cinfo.max_v_samp_factor * DCTSIZE;
+    while (cinfo.next_scanline < cinfo.image_height) {
+        for (int ci = 0; ci < image->components; ci++) {
+            rawRowPointers(image, ci, cinfo.next_scanline / iMCUHeight, rows[ci]);
+        }
+        jpeg_write_raw_data(&cinfo, planes, iMCUHeight);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Error writing '%s': %s\n", filename, strerror(errno));
+        remove(filename);
+        return -1;
+    }
+    return 0;
+}
+
+void histeqFreePlanar(HistEqPlanarImage *image) {
+    // All planes share one allocation that starts with plane 0
+    free(image->planes[0]);
+    memset(image, 0, sizeof(*image));
+}
+
+int histeqPlanarLumaSize(const HistEqPlanarImage *image, int *width, int *height) {
+    int maxH = 1, maxV = 1;
+    for (int ci = 0; ci < image->components; ci++) {
+        maxH = (image->hSamp[ci] > maxH) ? image->hSamp[ci] : maxH;
+        maxV = (image->vSamp[ci] > maxV) ? image->vSamp[ci] : maxV;
+    }
+    *width = histeqSampledSize(image->width, image->hSamp[0], maxH);
+    *height = histeqSampledSize(image->height, image->vSamp[0], maxV);
+    if (*width > image->planeWidth[0] || *height > image->planeHeight[0]) {
+        fprintf(stderr, "Y plane of %dx%d is smaller than its visible %dx%d\n",
+                image->planeWidth[0], image->planeHeight[0], *width, *height);
+        return -1;
+    }
+    return 0;
+}
+
+int histeqEqualizeJPEGYCbCr(const HistEqBackend *backend, const char *inputFile, const char *outputFile,
+                            int histogramBefore[HISTEQ_BINS], int histogramAfter[HISTEQ_BINS]) {
+    HistEqPlanarImage image;
+    if (histeqReadJPEGPlanar(inputFile, &image) != 0) {
+        return -1;
+    }
+    int status = histeqEqualizePlanar(backend, &image, histogramBefore, histogramAfter);
+    if (status == 0) {
+        status = histeqWriteJPEGPlanar(outputFile, &image);
+    }
+    histeqFreePlanar(&image);
+    return status;
+}
+
+struct HistEqTranscoder {
+    struct jpeg_decompress_struct cinfo;
+    ErrorManager jerr;
+    FILE *input;
+    jvirt_barray_ptr *coefficients;
+    unsigned char *luma;            // decoded Y, whole blocks
+    size_t lumaStride;
+    int lumaBlockRows;
+    int lumaWidth;                  // visible part of the Y plane
+    int lumaHeight;
+    int histogram[HISTEQ_BINS];
+};
+
+// IDCTs (forward = 0) or FDCTs (forward = 1) every block of the Y component
+static void transformLuma(HistEqTranscoder *t, int forward) {
+    jpeg_component_info *component = &t->cinfo.comp_info[0];
+    const unsigned short *quant = component->quant_table->quantval;
+
+    for (int row = 0; row < t->lumaBlockRows; row++) {
+        JBLOCKARRAY blocks = (*t->cinfo.mem->access_virt_barray)((j_common_ptr)&t->cinfo, t->coefficients[0], row, 1, forward);
+        unsigned char *pixels = t->luma + (size_t)row * DCTSIZE * t->lumaStride;
+        for (JDIMENSION column = 0; column < component->width_in_blocks; column++) {
+            if (forward) {
+                histeqFDCTBlock(pixels + column * DCTSIZE, t->lumaStride, quant, blocks[0][column]);
+            } else {
+                histeqIDCTBlock(blocks[0][column], quant, pixels + column * DCTSIZE, t->lumaStride);
+            }
+        }
+    }
+}
+
+// Creates the decompressor, reads the coefficients and decodes Y into
+// t->luma; 0 or -1. t->cinfo.mem starts out NULL (calloc), so closing after
+// a failed create is safe.
+static int readTranscoderLuma(HistEqTranscoder *t, const char *filename) {
+    if (setjmp(t->jerr.setjmp_buffer)) {
+        fprintf(stderr, "Error decoding '%s'\n", filename);
+        return -1;
+    }
+
+    jpeg_create_decompress(&t->cinfo);
+    jpeg_stdio_src(&t->cinfo, t->input);
+    jpeg_read_header(&t->cinfo, TRUE);
+    if (t->cinfo.jpeg_color_space != JCS_YCbCr && t->cinfo.jpeg_color_space != JCS_GRAYSCALE) {
+        fprintf(stderr, "'%s' is not a YCbCr or grayscale JPEG\n", filename);
+        return -1;
+    }
+    t->coefficients = jpeg_read_coefficients(&t->cinfo);
+
+    jpeg_component_info *component = &t->cinfo.comp_info[0];
+    t->lumaStride = (size_t)component->width_in_blocks * DCTSIZE;
+    t->lumaBlockRows = component->height_in_blocks;
+    t->lumaWidth = histeqSampledSize(t->cinfo.image_width, component->h_samp_factor, t->cinfo.max_h_samp_factor);
+    t->lumaHeight = histeqSampledSize(t->cinfo.image_height, component->v_samp_factor, t->cinfo.max_v_samp_factor);
+    t->luma = (unsigned char *)malloc(t->lumaStride * t->lumaBlockRows * DCTSIZE);
+    if (t->luma == NULL) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+
+    transformLuma(t, 0);
+    return 0;
+}
+
+HistEqTranscoder *histeqTranscodeOpen(const char *filename) {
+    HistEqTranscoder *t = (HistEqTranscoder *)calloc(1, sizeof(HistEqTranscoder));
+    if (t == NULL) {
+        perror("Memory allocation failed");
+        return NULL;
+    }
+    t->input = fopen(filename, "rb");
+    if (t->input == NULL) {
+        fprintf(stderr, "Error opening file '%s': %s\n", filename, strerror(errno));
+        free(t);
+        return NULL;
+    }
+
+    t->cinfo.err = jpeg_std_error(&t->jerr.pub);
+    t->jerr.pub.error_exit = errorExit;
+    if (readTranscoderLuma(t, filename) != 0) {
+        histeqTranscodeClose(t);
+        return NULL;
+    }
+
+    for (int y = 0; y < t->lumaHeight; y++) {
+        histeqHistogramRow(t->luma + (size_t)y * t->lumaStride, t->lumaWidth, t->histogram);
+    }
+    return t;
+}
+
+int histeqTranscodeEqualize(const HistEqBackend *backend, HistEqTranscoder *t,
+                            int histogramBefore[HISTEQ_BINS], int histogramAfter[HISTEQ_BINS]) {
+    unsigned char lut[HISTEQ_BINS];
+    histeqBuildLUT(t->histogram, (long long)t->lumaWidth * t->lumaHeight, lut);
+    backend->applyLUT(t->luma, t->lumaStride * t->lumaBlockRows * DCTSIZE, 1, lut);
+
+    if (setjmp(t->jerr.setjmp_buffer)) {
+        fprintf(stderr, "Error re-encoding the luma coefficients\n");
+        return -1;
+    }
+    transformLuma(t, 1);
+
+    if (histogramBefore != NULL) {
+        memcpy(histogramBefore, t->histogram, sizeof(t->histogram));
+    }
+    // The written blocks are re-quantized, so the LUT alone does not say what
+    // they decode to; decode them again and count that
+    if (histogramAfter != NULL) {
+        transformLuma(t, 0);
+        memset(histogramAfter, 0, HISTEQ_BINS * sizeof(int));
+        for (int y = 0; y < t->lumaHeight; y++) {
+            histeqHistogramRow(t->luma + (size_t)y * t->lumaStride, t->lumaWidth, histogramAfter);
+        }
+    }
+    return 0;
+}
+
+int histeqTranscodeWrite(HistEqTranscoder *t, const char *filename) {
+    struct jpeg_compress_struct cinfo;
+    FILE *volatile file = fopen(filename, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening file '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+
+    // Errors on the output side land on the transcoder's jump buffer. The jump
+    // is armed before jpeg_create_compress(), which can fail too; destroying
+    // an object whose memory manager is still NULL does nothing.
+    cinfo.err = &t->jerr.pub;
+    cinfo.mem = NULL;
+    if (setjmp(t->jerr.setjmp_buffer)) {
+        fprintf(stderr, "Error encoding '%s'\n", filename);
+        jpeg_destroy_compress(&cinfo);
+        fclose(file);
+        remove(filename);
+        return -1;
+    }
+
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, file);
+    jpeg_copy_critical_parameters(&t->cinfo, &cinfo);
+    jpeg_write_coefficients(&cinfo, t->coefficients);
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Error writing '%s': %s\n", filename, strerror(errno));
+        remove(filename);
+        return -1;
+    }
+    return 0;
+}
+
+void histeqTranscodeClose(HistEqTranscoder *t) {
+    // Destroying without finishing is fine whether or not the read completed
+    jpeg_destroy_decompress(&t->cinfo);
+    fclose(t->input);
+    free(t->luma);
+    free(t);
+}
+
+int histeqTranscodeJPEGLuma(const HistEqBackend *backend, const char *inputFile, const char *outputFile,
+                            int histogramBefore[HISTEQ_BINS], int histogramAfter[HISTEQ_BINS]) {
+    HistEqTranscoder *t = histeqTranscodeOpen(inputFile);
+    if (t == NULL) {
+        return -1;
+    }
+    int status = histeqTranscodeEqualize(backend, t, histogramBefore, histogramAfter);
+    if (status == 0) {
+        status = histeqTranscodeWrite(t, outputFile);
+    }
+    histeqTranscodeClose(t);
+    return status;
+}
+
+void readJPEG(const char *filename, unsigned char **data, int *width, int *height, int *color_space) {
+    if (histeqReadJPEG(filename, data, width, height, color_space) != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+void writeJPEG(const char *filename, unsigned char *data, int width, int height, int color_space) {
+    if (histeqWriteJPEG(filename, data, width, height, color_space) != 0) {
+        exit(EXIT_FAILURE);
+    }
+}
+
+void saveHistogramImageJPEG(const int histogram[], const char *filename) {
+    HISTEQ_TRACE_SCOPE("saveHistogramImageJPEG");
+    int width = 800;
+    int height = 400;
+    int barWidth = width / 256;
+    int maxHeight = height - 20;
+    int maxValue = 0;
+
+    // Find the maximum value in the histogram for scaling
+    for (int i = 0; i < 256; i++) {
+        if (histogram[i] > maxValue) {
+            maxValue = histogram[i];
+        }
+    }
+
+    // Create a buffer for the image (all white initially)
+    unsigned char *image_buffer = (unsigned char *)malloc(width * height * 3);
+    if (image_buffer == NULL) {
+        perror("Error allocating memory for histogram image");
+        exit(EXIT_FAILURE);
+    }
+
+    memset(image_buffer, 255, width * height * 3); // White background
+
+    // Draw the histogram bars
+    for (int i = 0; i < 256; i++) {
+        int barHeight = (maxValue > 0) ? ((double)histogram[i] / maxValue) * maxHeight : 0;
+        int y_offset = height - barHeight;
+        for (int y = y_offset; y < height; y++) {
+            for (int x = i * barWidth; x < (i + 1) * barWidth; x++) {
+                if (x >= 0 && x < width && y >= 0 && y < height) {
+                    int index = (y * width + x) * 3;
+                    image_buffer[index + 0] = 0;   // Red
+                    image_buffer[index + 1] = 0;   // Green
+                    image_buffer[index + 2] = 0;   // Blue
+                }
+            }
+        }
+    }
+
+    // Create JPEG image
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    FILE *file = fopen(filename, "wb");
+    if (file == NULL) {
+        perror("Error opening file");
+        free(image_buffer);
+        exit(EXIT_FAILURE);
+    }
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+    jpeg_stdio_dest(&cinfo, file);
+
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 75, TRUE);
+
+    jpeg_start_compress(&cinfo, TRUE);
+    writeRows(&cinfo, image_buffer, height, width * 3);
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+    fclose(file);
+    free(image_buffer);
+}
@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include "histeq_internal.h"
+
+// Counts in one 64-byte cache line
+#define LINE_BINS (64 / sizeof(int))
+
+int histeqAllocPartials(HistEqPartials *partials, int threads, size_t bins) {
+    partials->stride = (bins + LINE_BINS - 1) / LINE_BINS * LINE_BINS;
+    partials->bins = bins;
+    partials->threads = threads;
+    partials->rows = (int *)aligned_alloc(64, (size_t)threads * partials->stride * sizeof(int));
+    return (partials->rows != NULL) ? 0 : -1;
+}
+
+void histeqFreePartials(HistEqPartials *partials) {
+    free(partials->rows);
+    partials->rows = NULL;
+}
+
+// Cleared by the thread that counts into it, so on a NUMA machine the row
+// lives on that thread's node
+int *histeqPartialRow(const HistEqPartials *partials) {
+    int *row = partials->rows + (size_t)omp_get_thread_num() * partials->stride;
+    memset(row, 0, partials->bins * sizeof(int));
+    return row;
+}
+
+// Thread t sums the t-th share of the cache lines over all rows, so no two
+// threads write the same line and none waits for a lock. Every active thread
+// still reads all T rows, so the merge costs O(T) per thread: 256 bins are
+// only 16 lines, and past 16 threads the extra ones have no columns at all.
+// The whole merge is T * bins adds, small next to counting any real image.
+// `histogram` is complete once the team has passed its next barrier.
+void histeqReduceHistograms(const HistEqPartials *partials, int *histogram) {
+    int threads = omp_get_num_threads();
+    int thread = omp_get_thread_num();
+    size_t lines = partials->stride / LINE_BINS;
+    size_t begin = lines * thread / threads * LINE_BINS;
+    size_t end = lines * (thread + 1) / threads * LINE_BINS;
+    if (end > partials->bins) {
+        end = partials->bins;
+    }
+
+    // Added as unsigned, which also carries the unsigned counts of the
+    // 16-bit path through unchanged
+    unsigned int *sum = (unsigned int *)histogram;
+    #pragma omp barrier
+    for (int t = 0; t < threads; t++) {
+        const unsigned int *row = (const unsigned int *)partials->rows + (size_t)t * partials->stride;
+        for (size_t i = begin; i < end; i++) {
+            sum[i] += row[i];
+        }
+    }
+}
+
+static void openmpHistogram(const unsigned char *data, size_t pixels, int components, int histogram[HISTEQ_BINS]) {
+    HistEqPartials partials;
+    memset(histogram, 0, HISTEQ_BINS * sizeof(int));
+    if (histeqAllocPartials(&partials, omp_get_max_threads(), HISTEQ_BINS) != 0) {
+        // Out of memory: one thread does it all
+        histeqHistogramSlice(data, pixels, components, histogram);
+        return;
+    }
+
+    #pragma omp parallel
+    {
+        HISTEQ_TRACE_SCOPE("histogramSlice");
+        int *local_histogram = histeqPartialRow(&partials);
+        int threads = omp_get_num_threads();
+        int thread = omp_get_thread_num();
+        size_t begin = pixels * thread / threads;
+        size_t end = pixels * (thread + 1) / threads;
+        histeqHistogramSlice(data + begin * components, end - begin, components, local_histogram);
+        histeqReduceHistograms(&partials, histogram);
+    }
+    histeqFreePartials(&partials);
+}
+
+static void openmpApplyLUT(unsigned char *data, size_t pixels, int components, const unsigned char lut[HISTEQ_BINS]) {
+    if (components == 1) {
+        // One contiguous slice per thread so each runs the vector kernel
+        #pragma omp parallel
+        {
+            HISTEQ_TRACE_SCOPE("applyLUTSlice");
+            int threads = omp_get_num_threads();
+            int thread = omp_get_thread_num();
+            size_t begin = pixels * thread / threads;
+            size_t end = pixels * (thread + 1) / threads;
+            histeqApplyLUTRow(data + begin, end - begin, lut);
+        }
+    } else {
+        #pragma omp parallel for
+        for (size_t i = 0; i < pixels; i++) {
+            unsigned char *pixel = data + i * 3;
+            unsigned char equalizedValue = lut[histeqLuma(pixel)];
+            pixel[0] = equalizedValue;     // Red
+            pixel[1] = equalizedValue;     // Green
+            pixel[2] = equalizedValue;     // Blue
+        }
+    }
+}
+
+static void openmpLumaHistogram(const unsigned char *rgb, unsigned char *gray, size_t pixels, int histogram[HISTEQ_BINS]) {
+    HistEqPartials partials;
+    memset(histogram, 0, HISTEQ_BINS * sizeof(int));
+    if (histeqAllocPartials(&partials, omp_get_max_threads(), HISTEQ_BINS) != 0) {
+        histeqLumaHistogramSlice(rgb, gray, pixels, histogram);
+        return;
+    }
+
+    #pragma omp parallel
+    {
+        HISTEQ_TRACE_SCOPE("histogramSlice");
+        int *local_histogram = histeqPartialRow(&partials);
+        int threads = omp_get_num_threads();
+        int thread = omp_get_thread_num();
+        size_t begin = pixels * thread / threads;
+        size_t end = pixels * (thread + 1) / threads;
+        histeqLumaHistogramSlice(rgb + begin * 3, gray + begin, end - begin, local_histogram);
+        histeqReduceHistograms(&partials, histogram);
+    }
+    histeqFreePartials(&partials);
+}
+
+static void openmpApplyLUTGray(unsigned char *gray, unsigned char *rgb, size_t pixels, const unsigned char lut[HISTEQ_BINS]) {
+    #pragma omp parallel
+    {
+        HISTEQ_TRACE_SCOPE("applyLUTSlice");
+        int threads = omp_get_num_threads();
+        int thread = omp_get_thread_num();
+        size_t begin = pixels * thread / threads;
+        size_t end = pixels * (thread + 1) / threads;
+        histeqApplyLUTGraySlice(gray + begin, rgb + begin * 3, end - begin, lut);
+    }
+}
+
+// One parallel region per image: each thread counts its slice, the rows are
+// reduced, one thread builds the LUT while the others wait at the barrier
+// that ends the single, and each thread then maps the same slice it counted,
+// which for small images is still in its cache
+static void openmpEqualize(unsigned char *data, unsigned char *gray, size_t pixels, int components, int histogram[HISTEQ_BINS],
+                           unsigned char lut[HISTEQ_BINS]) {
+    (void)components;   // 3 always comes with a gray plane
+    HistEqPartials partials;
+    if (histeqAllocPartials(&partials, omp_get_max_threads(), HISTEQ_BINS) != 0) {
+        if (gray != NULL) {
+            openmpLumaHistogram(data, gray, pixels, histogram);
+            histeqBuildLUT(histogram, (long long)pixels, lut);
+            openmpApplyLUTGray(gray, data, pixels, lut);
+        } else {
+            openmpHistogram(data, pixels, 1, histogram);
+            histeqBuildLUT(histogram, (long long)pixels, lut);
+            openmpApplyLUT(data, pixels, 1, lut);
+        }
+        return;
+    }
+    memset(histogram, 0, HISTEQ_BINS * sizeof(int));
+
+    #pragma omp parallel
+    {
+        int threads = omp_get_num_threads();
+        int thread = omp_get_thread_num();
+        size_t begin = pixels * thread / threads;
+        size_t end = pixels * (thread + 1) / threads;
+
+        {
+            HISTEQ_TRACE_SCOPE("histogramSlice");
+            int *local_histogram = histeqPartialRow(&partials);
+            if (gray != NULL) {
+                histeqLumaHistogramSlice(data + begin * 3, gray + begin, end - begin, local_histogram);
+            } else {
+                histeqHistogramSlice(data + begin, end - begin, 1, local_histogram);
+            }
+            histeqReduceHistograms(&partials, histogram);
+        }
+
+        #pragma omp barrier
+        #pragma omp single
+        histeqBuildLUT(histogram, (long long)pixels, lut);
+
+        {
+            HISTEQ_TRACE_SCOPE("applyLUTSlice");
+            if (gray != NULL) {
+                histeqApplyLUTGraySlice(gray + begin, data + begin * 3, end - begin, lut);
+            } else {
+                histeqApplyLUTRow(data + begin, end - begin, lut);
+            }
+        }
+    }
+    histeqFreePartials(&partials);
+}
+
+const HistEqBackend histeqOpenMPBackend = {
+    "openmp",
+    openmpHistogram,
+    openmpApplyLUT,
+    openmpLumaHistogram,
+    openmpApplyLUTGray,
+    openmpEqualize
+};
@@ -0,0 +1,58 @@
+#include <string.h>
+#include "histeq_internal.h"
+
+void histeqScalarHistogram(const unsigned char *data, size_t pixels, int components, int histogram[HISTEQ_BINS]) {
+    memset(histogram, 0, HISTEQ_BINS * sizeof(int));
+
+    if (components == 1) {
+        for (size_t i = 0; i < pixels; i++) {
+            histogram[data[i]]++;
+        }
+    } else {
+        for (size_t i = 0; i < pixels; i++) {
+            histogram[histeqLuma(data + i * 3)]++;
+        }
+    }
+}
+
+void histeqScalarApplyLUT(unsigned char *data, size_t pixels, int components, const unsigned char lut[HISTEQ_BINS]) {
+    if (components == 1) {
+        for (size_t i = 0; i < pixels; i++) {
+            data[i] = lut[data[i]];
+        }
+    } else {
+        for (size_t i = 0; i < pixels; i++) {
+            unsigned char *pixel = data + i * 3;
+            unsigned char equalizedValue = lut[histeqLuma(pixel)];
+            pixel[0] = equalizedValue;     // Red
+            pixel[1] = equalizedValue;     // Green
+            pixel[2] = equalizedValue;     // Blue
+        }
+    }
+}
+
+void histeqScalarLumaHistogram(const unsigned char *rgb, unsigned char *gray, size_t pixels, int histogram[HISTEQ_BINS]) {
+    memset(histogram, 0, HISTEQ_BINS * sizeof(int));
+    for (size_t i = 0; i < pixels; i++) {
+        gray[i] = histeqLuma(rgb + i * 3);
+        histogram[gray[i]]++;
+    }
+}
+
+void histeqScalarApplyLUTGray(unsigned char *gray, unsigned char *rgb, size_t pixels, const unsigned char lut[HISTEQ_BINS]) {
+    for (size_t i = 0; i < pixels; i++) {
+        unsigned char equalizedValue = lut[gray[i]];
+        rgb[i * 3] = equalizedValue;         // Red
+        rgb[i * 3 + 1] = equalizedValue;     // Green
+        rgb[i * 3 + 2] = equalizedValue;     // Blue
+    }
+}
+
+const HistEqBackend histeqScalarBackend = {
+    "scalar",
+    histeqScalarHistogram,
+    histeqScalarApplyLUT,
+    histeqScalarLumaHistogram,
+    histeqScalarApplyLUTGray,
+    NULL
+};
@@ -0,0 +1,425 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "histeq_internal.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HISTEQ_X86 1
+#endif
+
+typedef void (*ApplyLUTKernel)(unsigned char *data, size_t count, const unsigned char lut[HISTEQ_BINS]);
+typedef void (*LumaKernel)(const unsigned char *rgb, unsigned char *gray, size_t pixels);
+typedef void (*SplitKernel)(const unsigned char *rgb, unsigned char *r, unsigned char *g, unsigned char *b, size_t pixels);
+typedef void (*MergeKernel)(const unsigned char *r, const unsigned char *g, const unsigned char *b, unsigned char *rgb, size_t pixels);
+
+// Pixels converted per luma block when histogramming RGB data
+#define LUMA_BLOCK 4096
+
+// Interleaved sub-histograms. Neighbouring pixels land in different banks, so
+// runs of equal values (sky, paper) don't serialize on one counter.
+#define HISTOGRAM_BANKS 4
+
+static void applyLUTScalar(unsigned char *data, size_t count, const unsigned char lut[HISTEQ_BINS]) {
+    for (size_t i = 0; i < count; i++) {
+        data[i] = lut[data[i]];
+    }
+}
+
+void histeqHistogramRow(const unsigned char *data, size_t count, int histogram[HISTEQ_BINS]) {
+    unsigned int banks[HISTOGRAM_BANKS][HISTEQ_BINS];
+    memset(banks, 0, sizeof(banks));
+
+    // 64 bytes per iteration as eight 8-byte words, two bytes per bank each
+    size_t i = 0;
+    for (; i + 64 <= count; i += 64) {
+        for (int k = 0; k < 64; k += 8) {
+            uint64_t word;
+            memcpy(&word, data + i + k, sizeof(word));
+            banks[0][word & 0xff]++;
+            banks[1][(word >> 8) & 0xff]++;
+            banks[2][(word >> 16) & 0xff]++;
+            banks[3][(word >> 24) & 0xff]++;
+            banks[0][(word >> 32) & 0xff]++;
+            banks[1][(word >> 40) & 0xff]++;
+            banks[2][(word >> 48) & 0xff]++;
+            banks[3][word >> 56]++;
+        }
+    }
+    for (; i < count; i++) {
+        banks[0][data[i]]++;
+    }
+
+    for (int v = 0; v < HISTEQ_BINS; v++) {
+        histogram[v] += banks[0][v] + banks[1][v] + banks[2][v] + banks[3][v];
+    }
+}
+
+static void lumaScalar(const unsigned char *rgb, unsigned char *gray, size_t pixels) {
+    for (size_t i = 0; i < pixels; i++) {
+        gray[i] = histeqLumaExact(rgb + i * 3);
+    }
+}
+
+static void lumaFastScalar(const unsigned char *rgb, unsigned char *gray, size_t pixels) {
+    for (size_t i = 0; i < pixels; i++) {
+        gray[i] = histeqLumaFast(rgb + i * 3);
+    }
+}
+
+static void splitScalar(const unsigned char *rgb, unsigned char *r, unsigned char *g, unsigned char *b, size_t pixels) {
+    for (size_t i = 0; i < pixels; i++) {
+        r[i] = rgb[i * 3];
+        g[i] = rgb[i * 3 + 1];
+        b[i] = rgb[i * 3 + 2];
+    }
+}
+
+static void mergeScalar(const unsigned char *r, const unsigned char *g, const unsigned char *b, unsigned char *rgb, size_t pixels) {
+    for (size_t i = 0; i < pixels; i++) {
+        rgb[i * 3] = r[i];
+        rgb[i * 3 + 1] = g[i];
+        rgb[i * 3 + 2] = b[i];
+    }
+}
+
+#ifdef HISTEQ_X86
+// Same double expression as histeqLumaExact, four pixels per step: one pshufb
+// splits R, G and B of four pixels, which are widened to doubles. The mul and
+// add order matches the scalar code and FMA is not enabled, so the result is
+// bit-exact.
+__attribute__((target("avx2")))
+static void lumaAVX2(const unsigned char *rgb, unsigned char *gray, size_t pixels) {
+    const __m128i splitChannels = _mm_setr_epi8(0, 3, 6, 9, 1, 4, 7, 10, 2, 5, 8, 11, -1, -1, -1, -1);
+    const __m128i packBytes = _mm_setr_epi8(0, 4, 8, 12, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    const __m256d weightR = _mm256_set1_pd(0.299);
+    const __m256d weightG = _mm256_set1_pd(0.587);
+    const __m256d weightB = _mm256_set1_pd(0.114);
+
+    // Each 16-byte load reads 4 bytes past the 4 pixels it converts
+    size_t i = 0;
+    for (; i + 6 <= pixels; i += 4) {
+        __m128i v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(rgb + i * 3)), splitChannels);
+        __m256d r = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(v));
+        __m256d g = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_srli_si128(v, 4)));
+        __m256d b = _mm256_cvtepi32_pd(_mm_cvtepu8_epi32(_mm_srli_si128(v, 8)));
+        __m256d y = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(r, weightR), _mm256_mul_pd(g, weightG)), _mm256_mul_pd(b, weightB));
+        int packed = _mm_cvtsi128_si32(_mm_shuffle_epi8(_mm256_cvttpd_epi32(y), packBytes));
+        memcpy(gray + i, &packed, 4);
+    }
+    lumaScalar(rgb + i * 3, gray + i, pixels - i);
+}
+
+// pshufb masks that pull one channel of 16 RGB pixels out of three 16-byte
+// registers; the three partial results are OR-ed together
+static const signed char channelMasks[3][3][16] = {
+    {   // Red
+        {0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+        {-1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14, -1, -1, -1, -1, -1},
+        {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 1, 4, 7, 10, 13}
+    },
+    {   // Green
+        {1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+        {-1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15, -1, -1, -1, -1, -1},
+        {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 2, 5, 8, 11, 14}
+    },
+    {   // Blue
+        {2, 5, 8, 11, 14, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
+        {-1, -1, -1, -1, -1, 1, 4, 7, 10, 13, -1, -1, -1, -1, -1, -1},
+        {-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 3, 6, 9, 12, 15}
+    }
+};
+
+// The inverse: pshufb masks that place the bytes of one channel of 16 pixels
+// into each of the three 16-byte blocks of interleaved output
+static const signed char interleaveMasks[3][3][16] = {
+    {   // Red
+        {0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5},
+        {-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1},
+        {-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1}
+    },
+    {   // Green
+        {-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1},
+        {5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10},
+        {-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1}
+    },
+    {   // Blue
+        {-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1},
+        {-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1},
+        {10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15}
+    }
+};
+
+__attribute__((target("avx2")))
+static inline __m128i splitChannel(__m128i a, __m128i b, __m128i c, int channel) {
+    return _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(a, _mm_loadu_si128((const __m128i *)channelMasks[channel][0])),
+                     _mm_shuffle_epi8(b, _mm_loadu_si128((const __m128i *)channelMasks[channel][1]))),
+        _mm_shuffle_epi8(c, _mm_loadu_si128((const __m128i *)channelMasks[channel][2])));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i deinterleaveChannel(__m128i a, __m128i b, __m128i c, int channel) {
+    return _mm256_cvtepu8_epi16(splitChannel(a, b, c, channel));
+}
+
+__attribute__((target("avx2")))
+static inline __m128i mergeBlock(__m128i r, __m128i g, __m128i b, int block) {
+    return _mm_or_si128(
+        _mm_or_si128(_mm_shuffle_epi8(r, _mm_loadu_si128((const __m128i *)interleaveMasks[0][block])),
+                     _mm_shuffle_epi8(g, _mm_loadu_si128((const __m128i *)interleaveMasks[1][block]))),
+        _mm_shuffle_epi8(b, _mm_loadu_si128((const __m128i *)interleaveMasks[2][block])));
+}
+
+// 16 pixels per step
+__attribute__((target("avx2")))
+static void splitAVX2(const unsigned char *rgb, unsigned char *r, unsigned char *g, unsigned char *b, size_t pixels) {
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        const unsigned char *block = rgb + i * 3;
+        __m128i x = _mm_loadu_si128((const __m128i *)block);
+        __m128i y = _mm_loadu_si128((const __m128i *)(block + 16));
+        __m128i z = _mm_loadu_si128((const __m128i *)(block + 32));
+        _mm_storeu_si128((__m128i *)(r + i), splitChannel(x, y, z, 0));
+        _mm_storeu_si128((__m128i *)(g + i), splitChannel(x, y, z, 1));
+        _mm_storeu_si128((__m128i *)(b + i), splitChannel(x, y, z, 2));
+    }
+    splitScalar(rgb + i * 3, r + i, g + i, b + i, pixels - i);
+}
+
+__attribute__((target("avx2")))
+static void mergeAVX2(const unsigned char *r, const unsigned char *g, const unsigned char *b, unsigned char *rgb, size_t pixels) {
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        unsigned char *block = rgb + i * 3;
+        __m128i x = _mm_loadu_si128((const __m128i *)(r + i));
+        __m128i y = _mm_loadu_si128((const __m128i *)(g + i));
+        __m128i z = _mm_loadu_si128((const __m128i *)(b + i));
+        _mm_storeu_si128((__m128i *)block, mergeBlock(x, y, z, 0));
+        _mm_storeu_si128((__m128i *)(block + 16), mergeBlock(x, y, z, 1));
+        _mm_storeu_si128((__m128i *)(block + 32), mergeBlock(x, y, z, 2));
+    }
+    mergeScalar(r + i, g + i, b + i, rgb + i * 3, pixels - i);
+}
+
+// Fixed-point luma, 16 pixels per step in 16-bit lanes. The weights sum to
+// 256, so the largest intermediate (255 * 256) still fits an unsigned word.
+__attribute__((target("avx2")))
+static void lumaFastAVX2(const unsigned char *rgb, unsigned char *gray, size_t pixels) {
+    const __m256i weightR = _mm256_set1_epi16(HISTEQ_LUMA_FAST_R);
+    const __m256i weightG = _mm256_set1_epi16(HISTEQ_LUMA_FAST_G);
+    const __m256i weightB = _mm256_set1_epi16(HISTEQ_LUMA_FAST_B);
+
+    size_t i = 0;
+    for (; i + 16 <= pixels; i += 16) {
+        const unsigned char *block = rgb + i * 3;
+        __m128i a = _mm_loadu_si128((const __m128i *)block);
+        __m128i b = _mm_loadu_si128((const __m128i *)(block + 16));
+        __m128i c = _mm_loadu_si128((const __m128i *)(block + 32));
+        __m256i y = _mm256_add_epi16(
+            _mm256_add_epi16(_mm256_mullo_epi16(deinterleaveChannel(a, b, c, 0), weightR),
+                             _mm256_mullo_epi16(deinterleaveChannel(a, b, c, 1), weightG)),
+            _mm256_mullo_epi16(deinterleaveChannel(a, b, c, 2), weightB));
+        y = _mm256_srli_epi16(y, 8);
+        __m128i packed = _mm_packus_epi16(_mm256_castsi256_si128(y), _mm256_extracti128_si256(y, 1));
+        _mm_storeu_si128((__m128i *)(gray + i), packed);
+    }
+    lumaFastScalar(rgb + i * 3, gray + i, pixels - i);
+}
+
+// AVX2 has no byte permute wide enough for 256 entries (a 16-table pshufb
+// cascade measured no faster than scalar), so widen the table to dwords and
+// gather 8 entries at a time, then pack the 32 results back to bytes.
+__attribute__((target("avx2")))
+static void applyLUTAVX2(unsigned char *data, size_t count, const unsigned char lut[HISTEQ_BINS]) {
+    int wideLUT[HISTEQ_BINS];
+    for (int i = 0; i < HISTEQ_BINS; i++) {
+        wideLUT[i] = lut[i];
+    }
+    const __m256i packOrder = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m128i low = _mm_loadu_si128((const __m128i *)(data + i));
+        __m128i high = _mm_loadu_si128((const __m128i *)(data + i + 16));
+        __m256i r0 = _mm256_i32gather_epi32(wideLUT, _mm256_cvtepu8_epi32(low), 4);
+        __m256i r1 = _mm256_i32gather_epi32(wideLUT, _mm256_cvtepu8_epi32(_mm_srli_si128(low, 8)), 4);
+        __m256i r2 = _mm256_i32gather_epi32(wideLUT, _mm256_cvtepu8_epi32(high), 4);
+        __m256i r3 = _mm256_i32gather_epi32(wideLUT, _mm256_cvtepu8_epi32(_mm_srli_si128(high, 8)), 4);
+        __m256i words = _mm256_packus_epi16(_mm256_packus_epi32(r0, r1), _mm256_packus_epi32(r2, r3));
+        _mm256_storeu_si256((__m256i *)(data + i), _mm256_permutevar8x32_epi32(words, packOrder));
+    }
+    applyLUTScalar(data + i, count - i, lut);
+}
+
+// vpermi2b looks up 128 entries at once from two registers; bit 7 of each
+// pixel then picks between the lower and upper half of the table.
+__attribute__((target("avx512f,avx512bw,avx512vbmi")))
+static void applyLUTAVX512VBMI(unsigned char *data, size_t count, const unsigned char lut[HISTEQ_BINS]) {
+    const __m512i t0 = _mm512_loadu_si512(lut);
+    const __m512i t1 = _mm512_loadu_si512(lut + 64);
+    const __m512i t2 = _mm512_loadu_si512(lut + 128);
+    const __m512i t3 = _mm512_loadu_si512(lut + 192);
+
+    size_t i = 0;
+    for (; i < count; i += 64) {
+        __mmask64 mask = (count - i >= 64) ? ~(__mmask64)0 : (((__mmask64)1 << (count - i)) - 1);
+        __m512i v = _mm512_maskz_loadu_epi8(mask, data + i);
+        __m512i low = _mm512_permutex2var_epi8(t0, v, t1);
+        __m512i high = _mm512_permutex2var_epi8(t2, v, t3);
+        __m512i result = _mm512_mask_blend_epi8(_mm512_movepi8_mask(v), low, high);
+        _mm512_mask_storeu_epi8(data + i, mask, result);
+    }
+}
+#endif
+
+static ApplyLUTKernel applyLUTKernel = applyLUTScalar;
+static const char *applyLUTKernelName = "scalar";
+static LumaKernel lumaKernel = lumaScalar;
+static LumaKernel lumaFastKernel = lumaFastScalar;
+static SplitKernel splitKernel = splitScalar;
+static MergeKernel mergeKernel = mergeScalar;
+static pthread_once_t kernelsResolved = PTHREAD_ONCE_INIT;
+
+// HISTEQ_ISA=scalar turns off every vector kernel and avx2 stops short of
+// AVX-512; unset, the CPU decides
+int histeqCPUHasAVX2(void) {
+#ifdef HISTEQ_X86
+    const char *isa = getenv("HISTEQ_ISA");
+    __builtin_cpu_init();
+    return (isa == NULL || strcmp(isa, "scalar") != 0) && __builtin_cpu_supports("avx2");
+#else
+    return 0;
+#endif
+}
+
+int histeqCPUHasFMA(void) {
+#ifdef HISTEQ_X86
+    return histeqCPUHasAVX2() && __builtin_cpu_supports("fma");
+#else
+    return 0;
+#endif
+}
+
+int histeqCPUHasAVX512VBMI(void) {
+#ifdef HISTEQ_X86
+    const char *isa = getenv("HISTEQ_ISA");
+    __builtin_cpu_init();
+    return (isa == NULL || strcmp(isa, "avx512vbmi") == 0) && __builtin_cpu_supports("avx512bw") &&
+           __builtin_cpu_supports("avx512vbmi");
+#else
+    return 0;
+#endif
+}
+
+// Pick the widest kernel the CPU supports; HISTEQ_ISA caps the choice, which
+// is handy when comparing kernels. Runs once, through pthread_once, so every
+// thread sees the whole set.
+static void resolveKernels(void) {
+#ifdef HISTEQ_X86
+    if (histeqCPUHasAVX2()) {
+        lumaKernel = lumaAVX2;
+        lumaFastKernel = lumaFastAVX2;
+        splitKernel = splitAVX2;
+        mergeKernel = mergeAVX2;
+    }
+    if (histeqCPUHasAVX512VBMI()) {
+        applyLUTKernel = applyLUTAVX512VBMI;
+        applyLUTKernelName = "avx512vbmi";
+    } else if (histeqCPUHasAVX2()) {
+        applyLUTKernel = applyLUTAVX2;
+        applyLUTKernelName = "avx2";
+    }
+#endif
+}
+
+void histeqApplyLUTRow(unsigned char *data, size_t count, const unsigned char lut[HISTEQ_BINS]) {
+    pthread_once(&kernelsResolved, resolveKernels);
+    applyLUTKernel(data, count, lut);
+}
+
+void histeqLumaRow(const unsigned char *rgb, unsigned char *gray, size_t pixels) {
+    pthread_once(&kernelsResolved, resolveKernels);
+    if (histeqLumaMode == HISTEQ_LUMA_FAST) {
+        lumaFastKernel(rgb, gray, pixels);
+    } else {
+        lumaKernel(rgb, gray, pixels);
+    }
+}
+
+void histeqSplitRGBRow(const unsigned char *rgb, unsigned char *r, unsigned char *g, unsigned char *b, size_t pixels) {
+    pthread_once(&kernelsResolved, resolveKernels);
+    splitKernel(rgb, r, g, b, pixels);
+}
+
+void histeqMergeRGBRow(const unsigned char *r, const unsigned char *g, const unsigned char *b, unsigned char *rgb, size_t pixels) {
+    pthread_once(&kernelsResolved, resolveKernels);
+    mergeKernel(r, g, b, rgb, pixels);
+}
+
+void histeqHistogramSlice(const unsigned char *data, size_t pixels, int components, int histogram[HISTEQ_BINS]) {
+    if (components == 1) {
+        histeqHistogramRow(data, pixels, histogram);
+        return;
+    }
+
+    unsigned char gray[LUMA_BLOCK];
+    for (size_t i = 0; i < pixels; i += LUMA_BLOCK) {
+        size_t count = (pixels - i < LUMA_BLOCK) ? pixels - i : LUMA_BLOCK;
+        histeqLumaRow(data + i * 3, gray, count);
+        histeqHistogramRow(gray, count, histogram);
+    }
+}
+
+void histeqLumaHistogramSlice(const unsigned char *rgb, unsigned char *gray, size_t pixels, int histogram[HISTEQ_BINS]) {
+    // Block-wise so each block of the gray plane is still in L1 when it is binned
+    for (size_t i = 0; i < pixels; i += LUMA_BLOCK) {
+        size_t count = (pixels - i < LUMA_BLOCK) ? pixels - i : LUMA_BLOCK;
+        histeqLumaRow(rgb + i * 3, gray + i, count);
+        histeqHistogramRow(gray + i, count, histogram);
+    }
+}
+
+void histeqApplyLUTGraySlice(unsigned char *gray, unsigned char *rgb, size_t pixels, const unsigned char lut[HISTEQ_BINS]) {
+    for (size_t i = 0; i < pixels; i += LUMA_BLOCK) {
+        size_t count = (pixels - i < LUMA_BLOCK) ? pixels - i : LUMA_BLOCK;
+        histeqApplyLUTRow(gray + i, count, lut);
+        for (size_t k = 0; k < count; k++) {
+            unsigned char *pixel = rgb + (i + k) * 3;
+            pixel[0] = pixel[1] = pixel[2] = gray[i + k];
+        }
+    }
+}
+
+const char *histeqApplyLUTKernelName(void) {
+    pthread_once(&kernelsResolved, resolveKernels);
+    return applyLUTKernelName;
+}
+
+static void simdHistogram(const unsigned char *data, size_t pixels, int components, int histogram[HISTEQ_BINS]) {
+    memset(histogram, 0, HISTEQ_BINS * sizeof(int));
+    histeqHistogramSlice(data, pixels, components, histogram);
+}
+
+static void simdApplyLUT(unsigned char *data, size_t pixels, int components, const unsigned char lut[HISTEQ_BINS]) {
+    if (components == 1) {
+        histeqApplyLUTRow(data, pixels, lut);
+    } else {
+        histeqScalarApplyLUT(data, pixels, components, lut);
+    }
+}
+
+static void simdLumaHistogram(const unsigned char *rgb, unsigned char *gray, size_t pixels, int histogram[HISTEQ_BINS]) {
+    memset(histogram, 0, HISTEQ_BINS * sizeof(int));
+    histeqLumaHistogramSlice(rgb, gray, pixels, histogram);
+}
+
+const HistEqBackend histeqSIMDBackend = {
+    "simd",
+    simdHistogram,
+    simdApplyLUT,
+    simdLumaHistogram,
+    histeqApplyLUTGraySlice,
+    NULL
+};
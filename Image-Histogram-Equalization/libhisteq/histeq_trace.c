@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "histeq_internal.h"
+
+// Each thread records into a buffer of its own, so recording takes no lock and
+// shares no cache line with other threads. A buffer is pushed once onto a
+// global list with a compare-and-swap and is never freed, which keeps the
+// events of threads that have exited (batch workers, OpenMP teams) exportable.
+
+typedef struct {
+    const char *name;
+    unsigned long long start;        // ns, CLOCK_MONOTONIC
+    unsigned long long duration;     // ns
+} TraceEvent;
+
+// Running totals per stage; these see every event, including the ones the
+// ring has since overwritten
+typedef struct {
+    const char *name;
+    _Atomic unsigned long long count;
+    _Atomic unsigned long long total;
+    _Atomic unsigned long long max;
+} TraceStat;
+
+typedef struct TraceBuffer {
+    struct TraceBuffer *next;
+    int thread;
+    _Atomic unsigned long long head;    // events written so far
+    _Atomic int stats;                  // entries of `stat` in use
+    TraceStat stat[HISTEQ_TRACE_STAGES];
+    TraceEvent events[HISTEQ_TRACE_EVENTS];
+} TraceBuffer;
+
+static _Atomic(TraceBuffer *) buffers = NULL;
+static atomic_int threadCount = 0;
+
+static __thread TraceBuffer *threadBuffer = NULL;
+static __thread int lastStat = 0;
+
+static unsigned long long traceNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + (unsigned long long)ts.tv_nsec;
+}
+
+static TraceBuffer *registerBuffer(void) {
+    TraceBuffer *buffer = (TraceBuffer *)calloc(1, sizeof(TraceBuffer));
+    if (buffer == NULL) {
+        return NULL;
+    }
+    buffer->thread = atomic_fetch_add(&threadCount, 1) + 1;
+
+    TraceBuffer *first = atomic_load(&buffers);
+    do {
+        buffer->next = first;
+    } while (!atomic_compare_exchange_weak(&buffers, &first, buffer));
+
+    threadBuffer = buffer;
+    return buffer;
+}
+
+// Stage names are string literals, so a pointer compare finds them; a scope
+// usually ends the stage the previous one did, hence the cached index
+static TraceStat *findStat(TraceBuffer *buffer, const char *name) {
+    int used = atomic_load_explicit(&buffer->stats, memory_order_relaxed);
+    if (lastStat < used && buffer->stat[lastStat].name == name) {
+        return &buffer->stat[lastStat];
+    }
+    for (int i = 0; i < used; i++) {
+        if (buffer->stat[i].name == name) {
+            lastStat = i;
+            return &buffer->stat[i];
+        }
+    }
+    if (used == HISTEQ_TRACE_STAGES) {
+        return NULL;
+    }
+    buffer->stat[used].name = name;
+    atomic_store_explicit(&buffer->stats, used + 1, memory_order_release);
+    lastStat = used;
+    return &buffer->stat[used];
+}
+
+// Only the owning thread writes a counter, so a relaxed load and store is
+// enough; the atomics just keep a concurrent export from reading torn values
+static void addRelaxed(_Atomic unsigned long long *counter, unsigned long long value) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+HistEqTraceScope histeqTraceBegin(const char *name) {
+    HistEqTraceScope scope = {name, traceNow()};
+    return scope;
+}
+
+void histeqTraceEnd(HistEqTraceScope *scope) {
+    unsigned long long end = traceNow();
+    TraceBuffer *buffer = threadBuffer;
+    if (buffer == NULL && (buffer = registerBuffer()) == NULL) {
+        return;
+    }
+
+    unsigned long long duration = end - scope->start;
+    unsigned long long head = atomic_load_explicit(&buffer->head, memory_order_relaxed);
+    TraceEvent *event = &buffer->events[head % HISTEQ_TRACE_EVENTS];
+    event->name = scope->name;
+    event->start = scope->start;
+    event->duration = duration;
+    atomic_store_explicit(&buffer->head, head + 1, memory_order_release);
+
+    TraceStat *stat = findStat(buffer, scope->name);
+    if (stat != NULL) {
+        addRelaxed(&stat->count, 1);
+        addRelaxed(&stat->total, duration);
+        if (duration > atomic_load_explicit(&stat->max, memory_order_relaxed)) {
+            atomic_store_explicit(&stat->max, duration, memory_order_relaxed);
+        }
+    }
+}
+
+// Copies the events of one buffer still held by its ring into `events`, oldest
+// first, and returns how many. Events the owner overwrote during the copy are
+// left out.
+static size_t snapshotEvents(TraceBuffer *buffer, TraceEvent *events, unsigned long long *dropped) {
+    unsigned long long head = atomic_load_explicit(&buffer->head, memory_order_acquire);
+    unsigned long long first = (head > HISTEQ_TRACE_EVENTS) ? head - HISTEQ_TRACE_EVENTS : 0;
+    for (unsigned long long i = first; i < head; i++) {
+        events[i - first] = buffer->events[i % HISTEQ_TRACE_EVENTS];
+    }
+
+    // The owner may already be writing event `after`, into the slot of event
+    // after - HISTEQ_TRACE_EVENTS
+    unsigned long long after = atomic_load_explicit(&buffer->head, memory_order_acquire);
+    unsigned long long valid = (after + 1 > HISTEQ_TRACE_EVENTS) ? after + 1 - HISTEQ_TRACE_EVENTS : 0;
+    size_t skip = (valid > first) ? (size_t)(valid - first) : 0;
+    if (skip > head - first) {
+        skip = (size_t)(head - first);
+    }
+    memmove(events, events + skip, (size_t)(head - first - skip) * sizeof(TraceEvent));
+    *dropped += first + skip;
+    return (size_t)(head - first - skip);
+}
+
+// Stage names come from this library, but are escaped anyway
+static void writeJSONString(FILE *file, const char *text) {
+    fputc('"', file);
+    for (const char *c = text; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', file);
+        }
+        fputc((unsigned char)*c < 0x20 ? ' ' : *c, file);
+    }
+    fputc('"', file);
+}
+
+static int closeOutput(FILE *file, const char *filename) {
+    if (ferror(file) | (fclose(file) != 0)) {
+        fprintf(stderr, "Error writing '%s': %s\n", filename, strerror(errno));
+        remove(filename);
+        return -1;
+    }
+    return 0;
+}
+
+int histeqTraceWriteChrome(const char *filename) {
+    TraceEvent *events = (TraceEvent *)malloc(HISTEQ_TRACE_EVENTS * sizeof(TraceEvent));
+    if (events == NULL) {
+        perror("Memory allocation failed");
+        return -1;
+    }
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening file '%s': %s\n", filename, strerror(errno));
+        free(events);
+        return -1;
+    }
+
+    // Complete ("X") events in microseconds of CLOCK_MONOTONIC, one track per
+    // thread; the viewers start the timeline at the first event
+    unsigned long long dropped = 0;
+    int first = 1;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    for (TraceBuffer *buffer = atomic_load(&buffers); buffer != NULL; buffer = buffer->next) {
+        fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+                first ? "" : ",", buffer->thread, buffer->thread);
+        first = 0;
+
+        size_t count = snapshotEvents(buffer, events, &dropped);
+        for (size_t i = 0; i < count; i++) {
+            fprintf(file, ",\n{\"name\":");
+            writeJSONString(file, events[i].name);
+            fprintf(file, ",\"cat\":\"histeq\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", buffer->thread,
+                    events[i].start / 1e3, events[i].duration / 1e3);
+        }
+    }
+    fprintf(file, "\n],\"otherData\":{\"droppedEvents\":%llu}}\n", dropped);
+    free(events);
+    return closeOutput(file, filename);
+}
+
+int histeqTraceWritePrometheus(const char *filename) {
+    // Totals of all threads by stage name
+    const char *names[HISTEQ_TRACE_STAGES];
+    unsigned long long count[HISTEQ_TRACE_STAGES], total[HISTEQ_TRACE_STAGES], max[HISTEQ_TRACE_STAGES];
+    unsigned long long events = 0;
+    int stages = 0, threads = 0;
+
+    for (TraceBuffer *buffer = atomic_load(&buffers); buffer != NULL; buffer = buffer->next) {
+        threads++;
+        events += atomic_load_explicit(&buffer->head, memory_order_acquire);
+        int used = atomic_load_explicit(&buffer->stats, memory_order_acquire);
+        for (int i = 0; i < used; i++) {
+            const TraceStat *stat = &buffer->stat[i];
+            int s = 0;
+            while (s < stages && strcmp(names[s], stat->name) != 0) {
+                s++;
+            }
+            if (s == stages) {
+                if (stages == HISTEQ_TRACE_STAGES) {
+                    continue;
+                }
+                names[s] = stat->name;
+                count[s] = total[s] = max[s] = 0;
+                stages++;
+            }
+            unsigned long long longest = atomic_load_explicit(&stat->max, memory_order_relaxed);
+            count[s] += atomic_load_explicit(&stat->count, memory_order_relaxed);
+            total[s] += atomic_load_explicit(&stat->total, memory_order_relaxed);
+            max[s] = (longest > max[s]) ? longest : max[s];
+        }
+    }
+
+    FILE *file = fopen(filename, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Error opening file '%s': %s\n", filename, strerror(errno));
+        return -1;
+    }
+    fprintf(file, "# HELP histeq_stage_calls_total Traced scopes completed, by stage.\n");
+    fprintf(file, "# TYPE histeq_stage_calls_total counter\n");
+    for (int s = 0; s < stages; s++) {
+        fprintf(file, "histeq_stage_calls_total{stage=\"%s\"} %llu\n", names[s], count[s]);
+    }
+    fprintf(file, "# HELP histeq_stage_seconds_total Time spent in traced scopes, summed over threads.\n");
+    fprintf(file, "# TYPE histeq_stage_seconds_total counter\n");
+    for (int s = 0; s < stages; s++) {
+        fprintf(file, "histeq_stage_seconds_total{stage=\"%s\"} %.9f\n", names[s], total[s] / 1e9);
+    }
+    fprintf(file, "# HELP histeq_stage_max_seconds Longest single scope, by stage.\n");
+    fprintf(file, "# TYPE histeq_stage_max_seconds gauge\n");
+    for (int s = 0; s < stages; s++) {
+        fprintf(file, "histeq_stage_max_seconds{stage=\"%s\"} %.9f\n", names[s], max[s] / 1e9);
+    }
+    fprintf(file, "# HELP histeq_trace_events_total Events recorded, including those overwritten in the ring buffers.\n");
+    fprintf(file, "# TYPE histeq_trace_events_total counter\n");
+    fprintf(file, "histeq_trace_events_total %llu\n", events);
+    fprintf(file, "# HELP histeq_trace_threads Threads that recorded events.\n");
+    fprintf(file, "# TYPE histeq_trace_threads gauge\n");
+    fprintf(file, "histeq_trace_threads %d\n", threads);
+    return closeOutput(file, filename);
+}
@@ -0,0 +1,241 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+#include <pthread.h>
+#include "histeq_internal.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HISTEQ_X86 1
+#endif
+
+// 16-bit samples. The histogram has one bin per value up to the image's
+// highest set bit, so 12-bit data in a 16-bit container gets 4096 bins
+// (16 KB, in L1) and only real 16-bit data the full 65536 (256 KB).
+
+// Up to this many bins the histogram is two interleaved uint32 banks
+#define WIDE_SMALL_BINS 4096
+
+// Pixels per flush of the uint16 banks; each bank sees half of them, so no
+// count can pass 65535
+#define WIDE_BLOCK (2 * 65535)
+
+typedef void (*ApplyLUT16Kernel)(unsigned short *data, size_t count, const unsigned short *lut);
+
+static void applyLUT16Scalar(unsigned short *data, size_t count, const unsigned short *lut) {
+    for (size_t i = 0; i < count; i++) {
+        data[i] = lut[data[i]];
+    }
+}
+
+#ifdef HISTEQ_X86
+// 16 samples per step in two 32-bit gathers at 2-byte scale. Each reads the
+// entry and the one after it, hence the padding entry at the end of the LUT.
+__attribute__((target("avx2")))
+static void applyLUT16AVX2(unsigned short *data, size_t count, const unsigned short *lut) {
+    const __m256i low = _mm256_set1_epi32(0xFFFF);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+        __m256i a = _mm256_i32gather_epi32((const int *)lut, _mm256_cvtepu16_epi32(_mm256_castsi256_si128(v)), 2);
+        __m256i b = _mm256_i32gather_epi32((const int *)lut, _mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1)), 2);
+        __m256i packed = _mm256_packus_epi32(_mm256_and_si256(a, low), _mm256_and_si256(b, low));
+        _mm256_storeu_si256((__m256i *)(data + i), _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+    applyLUT16Scalar(data + i, count - i, lut);
+}
+#endif
+
+static ApplyLUT16Kernel applyLUT16Kernel = applyLUT16Scalar;
+static pthread_once_t kernelResolved = PTHREAD_ONCE_INIT;
+
+static void resolveApplyLUT16Kernel(void) {
+#ifdef HISTEQ_X86
+    if (histeqCPUHasAVX2()) {
+        applyLUT16Kernel = applyLUT16AVX2;
+    }
+#endif
+}
+
+int histeqSignificantBits16(const unsigned short *data, size_t count) {
+    unsigned int highest = 0;
+    for (size_t i = 0; i < count; i++) {
+        highest |= data[i];
+    }
+    int bits = 1;
+    while (bits < HISTEQ_WIDE_MAX_BITS && (highest >> bits) != 0) {
+        bits++;
+    }
+    return bits;
+}
+
+void histeqHistogram16(const unsigned short *data, size_t count, int bits, unsigned int *histogram) {
+    size_t bins = (size_t)1 << bits;
+
+    if (bins <= WIDE_SMALL_BINS) {
+        // Two banks so runs of one value do not wait on their own increments
+        unsigned int banks[2][WIDE_SMALL_BINS];
+        memset(banks[0], 0, bins * sizeof(unsigned int));
+        memset(banks[1], 0, bins * sizeof(unsigned int));
+        size_t i = 0;
+        for (; i + 2 <= count; i += 2) {
+            banks[0][data[i]]++;
+            banks[1][data[i + 1]]++;
+        }
+        for (; i < count; i++) {
+            banks[0][data[i]]++;
+        }
+        for (size_t v = 0; v < bins; v++) {
+            histogram[v] += banks[0][v] + banks[1][v];
+        }
+        return;
+    }
+
+    // A uint32 table of 65536 bins is already 256 KB, the size of a whole L2
+    // on many parts. Two uint16 banks take the same room, and are flushed into
+    // the caller's table after every block.
+    unsigned short *banks = (unsigned short *)malloc(2 * bins * sizeof(unsigned short));
+    if (banks == NULL) {
+        for (size_t i = 0; i < count; i++) {
+            histogram[data[i]]++;
+        }
+        return;
+    }
+    unsigned short *even = banks;
+    unsigned short *odd = banks + bins;
+    for (size_t start = 0; start < count; start += WIDE_BLOCK) {
+        size_t end = (count - start < WIDE_BLOCK) ? count : start + WIDE_BLOCK;
+        memset(banks, 0, 2 * bins * sizeof(unsigned short));
+        size_t i = start;
+        for (; i + 2 <= end; i += 2) {
+            even[data[i]]++;
+            odd[data[i + 1]]++;
+        }
+        for (; i < end; i++) {
+            even[data[i]]++;
+        }
+        // In runs of 8 bins, which the compiler turns into vector adds
+        for (size_t v = 0; v < bins; v += 8) {
+            for (int k = 0; k < 8; k++) {
+                histogram[v + k] += (unsigned int)even[v + k] + odd[v + k];
+            }
+        }
+    }
+    free(banks);
+}
+
+void histeqBuildLUT16(const unsigned int *histogram, int bits, long long totalPixels, int outputBits, unsigned short *lut) {
+    size_t bins = (size_t)1 << bits;
+    double top = (double)((1 << outputBits) - 1);
+
+    // Same mapping as histeqBuildLUT(), with the CDF in 64 bits and double
+    if (totalPixels <= 1) {
+        for (size_t i = 0; i < bins; i++) {
+            lut[i] = (unsigned short)(i * top / (bins - 1));
+        }
+    } else {
+        long long cumulative = histogram[0];
+        lut[0] = 0;
+        for (size_t i = 1; i < bins; i++) {
+            cumulative += histogram[i];
+            // Without a pixel at 0 the top value maps to N / (N - 1) * top
+            double mapped = (double)(cumulative - histogram[0]) / (totalPixels - 1) * top;
+            lut[i] = (unsigned short)(mapped < top ? mapped : top);
+        }
+    }
+    lut[bins] = lut[bins - 1];
+}
+
+void histeqApplyLUT16Row(unsigned short *data, size_t count, const unsigned short *lut) {
+    pthread_once(&kernelResolved, resolveApplyLUT16Kernel);
+    ApplyLUT16Kernel kernel = applyLUT16Kernel;
+    kernel(data, count, lut);
+}
+
+// Luma weights of the 8-bit path in 16-bit fixed point, rounded
+static void luma16Row(const unsigned short *rgb, unsigned short *gray, size_t pixels) {
+    for (size_t i = 0; i < pixels; i++) {
+        const unsigned short *pixel = rgb + i * 3;
+        gray[i] = (unsigned short)((19595u * pixel[0] + 38470u * pixel[1] + 7471u * pixel[2] + 32768u) >> 16);
+    }
+}
+
+int histeqEqualize16(const HistEqBackend *backend, unsigned short *data, int width, int height, int components, int outputBits) {
+    if (components != 1 && components != 3) {
+        fprintf(stderr, "Expected 1 or 3 components, got %d\n", components);
+        return -1;
+    }
+    if (outputBits < 1 || outputBits > HISTEQ_WIDE_MAX_BITS) {
+        fprintf(stderr, "Output depth must be between 1 and %d bits\n", HISTEQ_WIDE_MAX_BITS);
+        return -1;
+    }
+
+    // RGB is equalized on luma, and like histeqEqualize() the result is
+    // written to all three channels
+    size_t pixels = (size_t)width * height;
+    unsigned short *gray = data;
+    if (components == 3) {
+        gray = (unsigned short *)malloc((pixels > 0 ? pixels : 1) * sizeof(unsigned short));
+        if (gray == NULL) {
+            perror("Memory allocation failed");
+            return -1;
+        }
+        luma16Row(data, gray, pixels);
+    }
+
+    // Only the OpenMP backend spreads the slices over threads, and only the
+    // scalar backend keeps the scalar apply
+    int parallel = backend == &histeqOpenMPBackend;
+    int bits = histeqSignificantBits16(gray, pixels);
+    size_t bins = (size_t)1 << bits;
+    unsigned int *histogram = (unsigned int *)calloc(bins, sizeof(unsigned int));
+    unsigned short *lut = (unsigned short *)malloc((bins + 1) * sizeof(unsigned short));
+    HistEqPartials partials = {NULL, 0, 0, 0};
+    if (histogram == NULL || lut == NULL || histeqAllocPartials(&partials, parallel ? omp_get_max_threads() : 1, bins) != 0) {
+        perror("Memory allocation failed");
+        free(histogram);
+        free(lut);
+        histeqFreePartials(&partials);
+        if (gray != data) {
+            free(gray);
+        }
+        return -1;
+    }
+    pthread_once(&kernelResolved, resolveApplyLUT16Kernel);
+    ApplyLUT16Kernel apply = applyLUT16Kernel;
+    if (backend == &histeqScalarBackend) {
+        apply = applyLUT16Scalar;
+    }
+
+    #pragma omp parallel if (parallel)
+    {
+        int threads = omp_get_num_threads();
+        int thread = omp_get_thread_num();
+        size_t begin = pixels * thread / threads;
+        size_t end = pixels * (thread + 1) / threads;
+
+        histeqHistogram16(gray + begin, end - begin, bits, (unsigned int *)histeqPartialRow(&partials));
+        histeqReduceHistograms(&partials, (int *)histogram);
+
+        #pragma omp barrier
+        #pragma omp single
+        histeqBuildLUT16(histogram, bits, (long long)pixels, outputBits, lut);
+
+        apply(gray + begin, end - begin, lut);
+        if (components == 3) {
+            for (size_t i = begin; i < end; i++) {
+                unsigned short *pixel = data + i * 3;
+                pixel[0] = pixel[1] = pixel[2] = gray[i];
+            }
+        }
+    }
+
+    histeqFreePartials(&partials);
+    free(histogram);
+    free(lut);
+    if (gray != data) {
+        free(gray);
+    }
+    return bits;
+}
@@ -1,7 +1,10 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <cuda_runtime.h>
 #include <time.h>
+#include "../libhisteq/histeq.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -16,70 +19,55 @@
     } \
 }
 
+// Gray value of an RGB pixel in the library's exact or fixed-point luma mode
+__device__ unsigned char luma(const unsigned char *pixel, int fastLuma) {
+    if (fastLuma) {
+        return (unsigned char)((HISTEQ_LUMA_FAST_R * pixel[0] + HISTEQ_LUMA_FAST_G * pixel[1] + HISTEQ_LUMA_FAST_B * pixel[2]) >> 8);
+    }
+    // Explicit rounding intrinsics stop nvcc from fusing into FMA, which would break bit-exactness with the CPU
+    return (unsigned char)__dadd_rn(__dadd_rn(__dmul_rn(pixel[0], 0.299), __dmul_rn(pixel[1], 0.587)), __dmul_rn(pixel[2], 0.114));
+}
+
 // CUDA kernel to compute the histogram
-__global__ void computeHistogram(const unsigned char *data, int width, int height, int *histogram) {
+__global__ void computeHistogram(const unsigned char *data, int width, int height, int *histogram, int fastLuma) {
     int x = blockIdx.x * blockDim.x + threadIdx.x;
     int y = blockIdx.y * blockDim.y + threadIdx.y;
 
     if (x < width && y < height) {
         int idx = y * width * 3 + x * 3;
-        unsigned char gray = (unsigned char)((data[idx] * 0.299) + (data[idx + 1] * 0.587) + (data[idx + 2] * 0.114));
+        unsigned char gray = luma(data + idx, fastLuma);
         atomicAdd(&histogram[gray], 1);
     }
 }
 
-// CUDA kernel to perform histogram equalization
-__global__ void equalizeHistogram(unsigned char *data, int width, int height, const int *cumulativeHistogram, int totalPixels) {
+// CUDA kernel to apply the equalization lookup table built on the host
+__global__ void equalizeHistogram(unsigned char *data, int width, int height, const unsigned char *lut, int fastLuma) {
     int x = blockIdx.x * blockDim.x + threadIdx.x;
     int y = blockIdx.y * blockDim.y + threadIdx.y;
 
     if (x < width && y < height) {
         int idx = y * width * 3 + x * 3;
-        unsigned char gray = (unsigned char)((data[idx] * 0.299) + (data[idx + 1] * 0.587) + (data[idx + 2] * 0.114));
-        unsigned char equalizedValue = (unsigned char)(((float)cumulativeHistogram[gray] / (totalPixels - 1)) * 255);
+        unsigned char gray = luma(data + idx, fastLuma);
+        unsigned char equalizedValue = lut[gray];
         data[idx] = equalizedValue;
         data[idx + 1] = equalizedValue;
         data[idx + 2] = equalizedValue;
     }
 }
 
-// Function to save histogram as an image
-void saveHistogramImage(const int *histogram, int width = 256, int height = 200) {
-    unsigned char *histogramImage = (unsigned char *)malloc(width * height * 3);
-    memset(histogramImage, 255, width * height * 3); // Initialize with white
-
-    int maxCount = 0;
-    for (int i = 0; i < 256; ++i) {
-        if (histogram[i] > maxCount) {
-            maxCount = histogram[i];
-        }
-    }
-
-    for (int i = 0; i < 256; ++i) {
-        int barHeight = (histogram[i] * height) / maxCount;
-        for (int y = 0; y < barHeight; ++y) {
-            int idx = ((height - y - 1) * width + i) * 3;
-            histogramImage[idx] = 0; // Red
-            histogramImage[idx + 1] = 0; // Green
-            histogramImage[idx + 2] = 0; // Blue
-        }
-    }
-
-    stbi_write_jpg("histogram.jpg", width, height, 3, histogramImage, 90);
-    free(histogramImage);
-}
-
 void histogramEqualization(unsigned char *data, int width, int height) {
     unsigned char *d_data;
-    int *d_histogram, *d_cumulativeHistogram;
+    int *d_histogram;
+    unsigned char *d_lut;
     int *histogram = (int *)malloc(256 * sizeof(int));
-    int *cumulativeHistogram = (int *)malloc(256 * sizeof(int));
+    unsigned char lut[HISTEQ_BINS];
     int totalPixels = width * height;
+    int fastLuma = histeqGetLumaMode() == HISTEQ_LUMA_FAST;
 
     // Allocate memory on the GPU
     CHECK_CUDA(cudaMalloc(&d_data, totalPixels * 3 * sizeof(unsigned char)));
     CHECK_CUDA(cudaMalloc(&d_histogram, 256 * sizeof(int)));
-    CHECK_CUDA(cudaMalloc(&d_cumulativeHistogram, 256 * sizeof(int)));
+    CHECK_CUDA(cudaMalloc(&d_lut, HISTEQ_BINS * sizeof(unsigned char)));
     
     // Copy data to the GPU
     CHECK_CUDA(cudaMemcpy(d_data, data, totalPixels * 3 * sizeof(unsigned char), cudaMemcpyHostToDevice));
@@ -90,7 +78,7 @@ void histogramEqualization(unsigned char *data, int width, int height) {
     dim3 blocksPerGrid((width + threadsPerBlock.x - 1) / threadsPerBlock.x, (height + threadsPerBlock.y - 1) / threadsPerBlock.y);
     
     clock_t start = clock();
-    computeHistogram<<<blocksPerGrid, threadsPerBlock>>>(d_data, width, height, d_histogram);
+    computeHistogram<<<blocksPerGrid, threadsPerBlock>>>(d_data, width, height, d_histogram, fastLuma);
     CHECK_CUDA(cudaDeviceSynchronize());
     clock_t end = clock();
 
@@ -100,18 +88,15 @@ void histogramEqualization(unsigned char *data, int width, int height) {
     // Copy histogram back to the CPU
     CHECK_CUDA(cudaMemcpy(histogram, d_histogram, 256 * sizeof(int), cudaMemcpyDeviceToHost));
 
-    // Calculate cumulative histogram
-    cumulativeHistogram[0] = histogram[0];
-    for (int i = 1; i < 256; i++) {
-        cumulativeHistogram[i] = cumulativeHistogram[i - 1] + histogram[i];
-    }
+    // Build the lookup table on the host, shared with the CPU programs
+    histeqBuildLUT(histogram, totalPixels, lut);
 
-    // Copy cumulative histogram to the GPU
-    CHECK_CUDA(cudaMemcpy(d_cumulativeHistogram, cumulativeHistogram, 256 * sizeof(int), cudaMemcpyHostToDevice));
+    // Copy lookup table to the GPU
+    CHECK_CUDA(cudaMemcpy(d_lut, lut, HISTEQ_BINS * sizeof(unsigned char), cudaMemcpyHostToDevice));
 
     // Launch kernel to equalize histogram
     start = clock();
-    equalizeHistogram<<<blocksPerGrid, threadsPerBlock>>>(d_data, width, height, d_cumulativeHistogram, totalPixels);
+    equalizeHistogram<<<blocksPerGrid, threadsPerBlock>>>(d_data, width, height, d_lut, fastLuma);
     CHECK_CUDA(cudaDeviceSynchronize());
     end = clock();
 
@@ -124,23 +109,46 @@ void histogramEqualization(unsigned char *data, int width, int height) {
     // Free GPU memory
     cudaFree(d_data);
     cudaFree(d_histogram);
-    cudaFree(d_cumulativeHistogram);
+    cudaFree(d_lut);
     
+    // Save histogram image
+    saveHistogramImageJPEG(histogram, "histogram.jpg");
+
     // Free CPU memory
     free(histogram);
-    free(cumulativeHistogram);
-
-    // Save histogram image
-    saveHistogramImage(histogram);
 }
 
-int main() {
+int main(int argc, char *argv[]) {
+    // Optional luma mode for the device kernels: exact (default) or fast
+    if (argc > 1) {
+        if (strcmp(argv[1], "fast") == 0) {
+            histeqSetLumaMode(HISTEQ_LUMA_FAST);
+        } else if (strcmp(argv[1], "exact") != 0) {
+            fprintf(stderr, "Unknown luma mode '%s' (exact or fast)\n", argv[1]);
+            return EXIT_FAILURE;
+        }
+    }
+
     char filename[256];
     printf("Enter the image file name: ");
     scanf("%255s", filename);
 
     int width, height, channels;
-    unsigned char *imageData = stbi_load(filename, &width, &height, &channels, 3);
+    unsigned char *imageData;
+    const unsigned char *fileData;
+    size_t fileSize;
+
+    // Decode straight from a mapping of the file; stdio for anything unmappable
+    // or past the int length stb_image takes
+    int mapped = histeqMapFile(filename, &fileData, &fileSize) == 0;
+    if (mapped && fileSize <= INT_MAX) {
+        imageData = stbi_load_from_memory(fileData, (int)fileSize, &width, &height, &channels, 3);
+    } else {
+        imageData = stbi_load(filename, &width, &height, &channels, 3);
+    }
+    if (mapped) {
+        histeqUnmapFile(fileData, fileSize);
+    }
 
     if (imageData == NULL) {
         fprintf(stderr, "Error opening image file\n");